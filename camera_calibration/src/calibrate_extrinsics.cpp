@@ -0,0 +1,318 @@
+/*
+By downloading, copying, installing or using the software you agree to this
+license. If you do not agree to this license, do not download, install,
+copy or use the software.
+
+                          License Agreement
+               For Open Source Computer Vision Library
+                       (3-clause BSD License)
+
+Copyright (C) 2013, OpenCV Foundation, all rights reserved.
+Third party copyrights are property of their respective owners.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+  * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+  * Neither the names of the copyright holders nor the names of the contributors
+    may be used to endorse or promote products derived from this software
+    without specific prior written permission.
+
+This software is provided by the copyright holders and contributors "as is" and
+any express or implied warranties, including, but not limited to, the implied
+warranties of merchantability and fitness for a particular purpose are
+disclaimed. In no event shall copyright holders or contributors be liable for
+any direct, indirect, incidental, special, exemplary, or consequential damages
+(including, but not limited to, procurement of substitute goods or services;
+loss of use, data, or profits; or business interruption) however caused
+and on any theory of liability, whether in contract, strict liability,
+or tort (including negligence or otherwise) arising in any way out of
+the use of this software, even if advised of the possibility of such damage.
+*/
+
+// FDCL Note: This is built on the GridBoard calibration program (main.cpp),
+// which has been copied from the OpenCV samples. It calibrates the
+// extrinsics of a rig of cameras, whose intrinsics have already been
+// calibrated, from a GridBoard seen by the reference camera and each of the
+// other cameras.
+
+#include <opencv2/highgui.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/aruco.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "fdcl_config.hpp"
+#include "fdcl_dictionary.hpp"
+#include "fdcl_multiview.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace {
+const char* about =
+        "Extrinsic calibration of a rig of cameras using a ArUco Planar Grid board\n"
+        "  The board must be seen by the first camera and at least one other camera.\n"
+        "  To capture a frame for calibration, press 'c',\n"
+        "  To finish capturing, press 'ESC' key and calibration starts.\n";
+const char* keys  =
+        "{w        |       | Number of squares in X direction }"
+        "{h        |       | Number of squares in Y direction }"
+        "{l        |       | Marker side length (in meters) }"
+        "{s        |       | Separation between two consecutive markers in the grid (in meters) }"
+        "{d        |       | dictionary: DICT_4X4_50=0, DICT_4X4_100=1, DICT_4X4_250=2,"
+        "DICT_4X4_1000=3, DICT_5X5_50=4, DICT_5X5_100=5, DICT_5X5_250=6, DICT_5X5_1000=7, "
+        "DICT_6X6_50=8, DICT_6X6_100=9, DICT_6X6_250=10, DICT_6X6_1000=11, DICT_7X7_50=12,"
+        "DICT_7X7_100=13, DICT_7X7_250=14, DICT_7X7_1000=15, DICT_ARUCO_ORIGINAL = 16}"
+        "{cd       |       | Custom dictionary file from generate_dictionary, overrides -d }"
+        "{@outfile |<none> | Output rig file with the intrinsics and extrinsics of all the cameras }"
+        "{vs       |       | Comma separated video sources of the cameras, the first one is the reference, e.g. 0,1 }"
+        "{cals     |       | Comma separated intrinsic calibration files from camera_calibration, one for each camera }"
+        "{dp       |       | File of marker detector parameters }"
+        "{cfg      |       | Pipeline config file, for the sources, the dictionary and the detector parameters }"
+        "{rs       | false | Apply refind strategy }"
+        "{fi       | true  | Fix the intrinsics, otherwise they are refined too "
+        "(camera 0 only with camera 1) }"
+        "{waitkey  | 10    | Time in milliseconds to wait for key press }";
+}
+
+
+/**
+ */
+static bool readCameraParams(const string &filename, fdcl::CameraView &view) {
+    FileStorage fs(filename, FileStorage::READ);
+    if(!fs.isOpened())
+        return false;
+    fs["camera_matrix"] >> view.camera_matrix;
+    fs["distortion_coefficients"] >> view.dist_coeffs;
+    view.image_size = Size((int)fs["image_width"], (int)fs["image_height"]);
+    return !view.camera_matrix.empty();
+}
+
+
+/**
+ * Board corners seen by both views of a capture, matched by marker id.
+ */
+static void matchBoardCorners(const Ptr<aruco::Board> &board,
+                              const vector< int > &ids0, const vector< vector< Point2f > > &corners0,
+                              const vector< int > &ids1, const vector< vector< Point2f > > &corners1,
+                              vector< Point3f > &objPoints,
+                              vector< Point2f > &imgPoints0, vector< Point2f > &imgPoints1) {
+    for(size_t j = 0; j < ids0.size(); j++) {
+        vector< int >::const_iterator it1 = find(ids1.begin(), ids1.end(), ids0[j]);
+        vector< int >::const_iterator itBoard = find(board->ids.begin(), board->ids.end(), ids0[j]);
+        if(it1 == ids1.end() || itBoard == board->ids.end()) continue;
+
+        const size_t k = it1 - ids1.begin();
+        const size_t b = itBoard - board->ids.begin();
+        for(int c = 0; c < 4; c++) {
+            objPoints.push_back(board->objPoints[b][c]);
+            imgPoints0.push_back(corners0[j][c]);
+            imgPoints1.push_back(corners1[k][c]);
+        }
+    }
+}
+
+
+/**
+ */
+int main(int argc, char *argv[]) {
+    CommandLineParser parser(argc, argv, keys);
+    parser.about(about);
+
+    if(argc < 8) {
+        parser.printMessage();
+        return 0;
+    }
+
+    int markersX = parser.get<int>("w");
+    int markersY = parser.get<int>("h");
+    float markerLength = parser.get<float>("l");
+    float markerSeparation = parser.get<float>("s");
+    string outputFile = parser.get<String>(0);
+
+    fdcl::PipelineConfig config;
+    if(!fdcl::parse_pipeline_config(parser, config)) {
+        return 1;
+    }
+
+    const fdcl::CommandLineArgs args(parser, argc, argv, config);
+    args.read("vs", config.videos);
+    args.read("d", config.dictionary);
+    args.read("cd", config.custom_dictionary);
+    if(args.read("dp", config.detector_params)) config.detector_node = "";
+    vector< string > calibrationFiles;
+    if(parser.has("cals")) calibrationFiles = fdcl::split_list(parser.get<String>("cals"));
+
+    bool refindStrategy = parser.get<bool>("rs");
+    bool fixIntrinsics = parser.get<bool>("fi");
+    int waitTime = parser.get<int>("waitkey");
+
+    if(!parser.check()) {
+        parser.printErrors();
+        return 0;
+    }
+
+    vector< string > sources = fdcl::split_list(config.videos);
+    if(sources.size() < 2 || sources.size() != calibrationFiles.size()) {
+        cerr << "At least two video sources, and one calibration file for each, are required" << endl;
+        return 0;
+    }
+
+    const size_t nCameras = sources.size();
+    vector< fdcl::CameraView > views(nCameras);
+    for(size_t i = 0; i < nCameras; i++) {
+        if(!readCameraParams(calibrationFiles[i], views[i])) {
+            cerr << "Invalid camera calibration file " << calibrationFiles[i] << endl;
+            return 0;
+        }
+    }
+
+    Ptr<aruco::DetectorParameters> detectorParams = fdcl::get_detector_parameters(config);
+    if(!detectorParams) {
+        return 0;
+    }
+
+    vector< VideoCapture > inputVideos(nCameras);
+    for(size_t i = 0; i < nCameras; i++) {
+        open_video_from_arg(sources[i], inputVideos[i]);
+        if(!inputVideos[i].isOpened()) {
+            cerr << "failed to open video input: " << sources[i] << endl;
+            return 1;
+        }
+    }
+
+    Ptr<aruco::Dictionary> dictionary = fdcl::get_dictionary(config);
+    if(!dictionary) {
+        return 1;
+    }
+
+    // create board object
+    Ptr<aruco::GridBoard> gridboard =
+            aruco::GridBoard::create(markersX, markersY, markerLength, markerSeparation, dictionary);
+    Ptr<aruco::Board> board = gridboard.staticCast<aruco::Board>();
+
+    // collected frames for calibration, for each camera
+    vector< vector< vector< vector< Point2f > > > > allCorners(nCameras);
+    vector< vector< vector< int > > > allIds(nCameras);
+
+    vector< Mat > images(nCameras);
+    vector< vector< int > > ids(nCameras);
+    vector< vector< vector< Point2f > > > corners(nCameras);
+
+    for(;;) {
+        // grab all the cameras first, so that their frames are close in time
+        bool grabbed = true;
+        for(size_t i = 0; i < nCameras; i++) grabbed = inputVideos[i].grab() && grabbed;
+        if(!grabbed) break;
+
+        for(size_t i = 0; i < nCameras; i++) {
+            inputVideos[i].retrieve(images[i]);
+
+            vector< vector< Point2f > > rejected;
+
+            // detect markers
+            aruco::detectMarkers(images[i], dictionary, corners[i], ids[i], detectorParams, rejected);
+
+            // refind strategy to detect more markers
+            if(refindStrategy) aruco::refineDetectedMarkers(images[i], board, corners[i], ids[i], rejected);
+
+            // draw results
+            Mat imageCopy;
+            images[i].copyTo(imageCopy);
+            if(ids[i].size() > 0) aruco::drawDetectedMarkers(imageCopy, corners[i], ids[i]);
+            putText(imageCopy, "Press 'c' to add current frames. 'ESC' to finish and calibrate",
+                    Point(10, 20), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 0, 0), 2);
+
+            imshow("Camera " + to_string(i), imageCopy);
+        }
+
+        char key = (char)waitKey(waitTime);
+        if(key == 27) break;
+        if(key == 'c' && ids[0].size() > 0) {
+            cout << "Frames captured" << endl;
+            for(size_t i = 0; i < nCameras; i++) {
+                allCorners[i].push_back(corners[i]);
+                allIds[i].push_back(ids[i]);
+            }
+        }
+    }
+
+    if(allIds[0].size() < 1) {
+        cerr << "Not enough captures for calibration" << endl;
+        return 0;
+    }
+
+    for(size_t i = 0; i < nCameras; i++) {
+        if(views[i].image_size.area() == 0) views[i].image_size = images[i].size();
+    }
+
+    vector< double > repErrors(nCameras, 0.0);
+
+    // calibrate each camera against the reference camera, x_i = R x_0 + T
+    for(size_t i = 1; i < nCameras; i++) {
+        vector< vector< Point3f > > objPoints;
+        vector< vector< Point2f > > imgPoints0, imgPointsI;
+
+        for(size_t f = 0; f < allIds[0].size(); f++) {
+            vector< Point3f > obj;
+            vector< Point2f > img0, imgI;
+            matchBoardCorners(board, allIds[0][f], allCorners[0][f], allIds[i][f], allCorners[i][f],
+                              obj, img0, imgI);
+            if(obj.size() < 4) continue;
+
+            objPoints.push_back(obj);
+            imgPoints0.push_back(img0);
+            imgPointsI.push_back(imgI);
+        }
+
+        if(objPoints.empty()) {
+            cerr << "The board was never seen by cameras 0 and " << i << " together" << endl;
+            return 0;
+        }
+
+        // FDCL: every extrinsic must rest on the same intrinsics of camera
+        // 0. When refining, they are refined with camera 1 only and fixed
+        // afterwards; the intrinsics of the other cameras are refined on
+        // their own first, since stereoCalibrate cannot fix one camera.
+        int calibrationFlags = CALIB_FIX_INTRINSIC;
+        if(!fixIntrinsics && i == 1) {
+            calibrationFlags = CALIB_USE_INTRINSIC_GUESS;
+        } else if(!fixIntrinsics) {
+            vector< Mat > rvecs, tvecs;
+            calibrateCamera(objPoints, imgPointsI, views[i].image_size, views[i].camera_matrix,
+                            views[i].dist_coeffs, rvecs, tvecs, CALIB_USE_INTRINSIC_GUESS);
+        }
+
+        Mat R, T, E, F;
+        repErrors[i] = stereoCalibrate(objPoints, imgPoints0, imgPointsI,
+                                       views[0].camera_matrix, views[0].dist_coeffs,
+                                       views[i].camera_matrix, views[i].dist_coeffs,
+                                       views[i].image_size, R, T, E, F, calibrationFlags);
+
+        views[i].R = Matx33d(R.ptr< double >());
+        views[i].t = Vec3d(T.ptr< double >());
+
+        cout << "Camera " << i << ": " << objPoints.size() << " captures, Rep Error: " << repErrors[i]
+             << ", Baseline: " << norm(T) << " m" << endl;
+    }
+
+    bool saveOk = fdcl::write_rig(outputFile, views, repErrors);
+    if(!saveOk) {
+        cerr << "Cannot save output file" << endl;
+        return 0;
+    }
+
+    cout << "Rig saved to " << outputFile << endl;
+
+    return 0;
+}
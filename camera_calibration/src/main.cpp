@@ -47,6 +47,10 @@ the use of this software, even if advised of the possibility of such damage.
 #include <iostream>
 #include <ctime>
 
+#include "calibration_utils.hpp"
+#include "fdcl_config.hpp"
+#include "fdcl_dictionary.hpp"
+
 using namespace std;
 using namespace cv;
 
@@ -66,10 +70,12 @@ const char* keys  =
         "DICT_4X4_1000=3, DICT_5X5_50=4, DICT_5X5_100=5, DICT_5X5_250=6, DICT_5X5_1000=7, "
         "DICT_6X6_50=8, DICT_6X6_100=9, DICT_6X6_250=10, DICT_6X6_1000=11, DICT_7X7_50=12,"
         "DICT_7X7_100=13, DICT_7X7_250=14, DICT_7X7_1000=15, DICT_ARUCO_ORIGINAL = 16}"
+        "{cd       |       | Custom dictionary file from generate_dictionary, overrides -d }"
         "{@outfile |<none> | Output file with calibrated camera parameters }"
         "{v        |       | Input from video file, if ommited, input comes from camera }"
         "{ci       | 0     | Camera id if input doesnt come from video (-v) }"
         "{dp       |       | File of marker detector parameters }"
+        "{cfg      |       | Pipeline config file, for the source, the dictionary and the detector parameters }"
         "{rs       | false | Apply refind strategy }"
         "{zt       | false | Assume zero tangential distortion }"
         "{a        |       | Fix aspect ratio (fx/fy) to this value }"
@@ -77,78 +83,6 @@ const char* keys  =
         "{waitkey  | 10    | Time in milliseconds to wait for key press }";
 }
 
-/**
- */
-static bool readDetectorParameters(string filename, Ptr<aruco::DetectorParameters> &params) {
-    FileStorage fs(filename, FileStorage::READ);
-    if(!fs.isOpened())
-        return false;
-    fs["adaptiveThreshWinSizeMin"] >> params->adaptiveThreshWinSizeMin;
-    fs["adaptiveThreshWinSizeMax"] >> params->adaptiveThreshWinSizeMax;
-    fs["adaptiveThreshWinSizeStep"] >> params->adaptiveThreshWinSizeStep;
-    fs["adaptiveThreshConstant"] >> params->adaptiveThreshConstant;
-    fs["minMarkerPerimeterRate"] >> params->minMarkerPerimeterRate;
-    fs["maxMarkerPerimeterRate"] >> params->maxMarkerPerimeterRate;
-    fs["polygonalApproxAccuracyRate"] >> params->polygonalApproxAccuracyRate;
-    fs["minCornerDistanceRate"] >> params->minCornerDistanceRate;
-    fs["minDistanceToBorder"] >> params->minDistanceToBorder;
-    fs["minMarkerDistanceRate"] >> params->minMarkerDistanceRate;
-    fs["cornerRefinementMethod"] >> params->cornerRefinementMethod;
-    fs["cornerRefinementWinSize"] >> params->cornerRefinementWinSize;
-    fs["cornerRefinementMaxIterations"] >> params->cornerRefinementMaxIterations;
-    fs["cornerRefinementMinAccuracy"] >> params->cornerRefinementMinAccuracy;
-    fs["markerBorderBits"] >> params->markerBorderBits;
-    fs["perspectiveRemovePixelPerCell"] >> params->perspectiveRemovePixelPerCell;
-    fs["perspectiveRemoveIgnoredMarginPerCell"] >> params->perspectiveRemoveIgnoredMarginPerCell;
-    fs["maxErroneousBitsInBorderRate"] >> params->maxErroneousBitsInBorderRate;
-    fs["minOtsuStdDev"] >> params->minOtsuStdDev;
-    fs["errorCorrectionRate"] >> params->errorCorrectionRate;
-    return true;
-}
-
-
-
-/**
- */
-static bool saveCameraParams(const string &filename, Size imageSize, float aspectRatio, int flags,
-                             const Mat &cameraMatrix, const Mat &distCoeffs, double totalAvgErr) {
-    FileStorage fs(filename, FileStorage::WRITE);
-    if(!fs.isOpened())
-        return false;
-
-    time_t tt;
-    time(&tt);
-    struct tm *t2 = localtime(&tt);
-    char buf[1024];
-    strftime(buf, sizeof(buf) - 1, "%c", t2);
-
-    fs << "calibration_time" << buf;
-
-    fs << "image_width" << imageSize.width;
-    fs << "image_height" << imageSize.height;
-
-    if(flags & CALIB_FIX_ASPECT_RATIO) fs << "aspectRatio" << aspectRatio;
-
-    if(flags != 0) {
-        sprintf(buf, "flags: %s%s%s%s",
-                flags & CALIB_USE_INTRINSIC_GUESS ? "+use_intrinsic_guess" : "",
-                flags & CALIB_FIX_ASPECT_RATIO ? "+fix_aspectRatio" : "",
-                flags & CALIB_FIX_PRINCIPAL_POINT ? "+fix_principal_point" : "",
-                flags & CALIB_ZERO_TANGENT_DIST ? "+zero_tangent_dist" : "");
-    }
-
-    fs << "flags" << flags;
-
-    fs << "camera_matrix" << cameraMatrix;
-    fs << "distortion_coefficients" << distCoeffs;
-
-    fs << "avg_reprojection_error" << totalAvgErr;
-
-    return true;
-}
-
-
-
 /**
  */
 int main(int argc, char *argv[]) {
@@ -164,7 +98,6 @@ int main(int argc, char *argv[]) {
     int markersY = parser.get<int>("h");
     float markerLength = parser.get<float>("l");
     float markerSeparation = parser.get<float>("s");
-    int dictionaryId = parser.get<int>("d");
     string outputFile = parser.get<String>(0);
 
     int calibrationFlags = 0;
@@ -176,23 +109,22 @@ int main(int argc, char *argv[]) {
     if(parser.get<bool>("zt")) calibrationFlags |= CALIB_ZERO_TANGENT_DIST;
     if(parser.get<bool>("pc")) calibrationFlags |= CALIB_FIX_PRINCIPAL_POINT;
 
-    Ptr<aruco::DetectorParameters> detectorParams = aruco::DetectorParameters::create();
-    if(parser.has("dp")) {
-        bool readOk = readDetectorParameters(parser.get<string>("dp"), detectorParams);
-        if(!readOk) {
-            cerr << "Invalid detector parameters file" << endl;
-            return 0;
-        }
+    // FDCL: the source, the dictionary and the detector parameters can also
+    // come from a pipeline config file, which the keys given explicitly on
+    // the command line override.
+    fdcl::PipelineConfig config;
+    if(!fdcl::parse_pipeline_config(parser, config)) {
+        return 1;
     }
 
-    bool refindStrategy = parser.get<bool>("rs");
-    int camId = parser.get<int>("ci");
-    String video;
-
-    if(parser.has("v")) {
-        video = parser.get<String>("v");
-    }
+    const fdcl::CommandLineArgs args(parser, argc, argv, config);
+    if(!args.read("v", config.video) && args.has("ci"))
+        config.video = to_string(parser.get<int>("ci"));
+    args.read("d", config.dictionary);
+    args.read("cd", config.custom_dictionary);
+    if(args.read("dp", config.detector_params)) config.detector_node = "";
 
+    bool refindStrategy = parser.get<bool>("rs");
     int waitTime = parser.get<int>("waitkey");
 
     if(!parser.check()) {
@@ -200,25 +132,20 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    String videoInput;
-    VideoCapture inputVideo;
-
-    bool opened;
-    if(!video.empty()) {
-        videoInput = video;
-        opened = inputVideo.open(video);
-    } else {
-        videoInput = camId;
-        opened = inputVideo.open(camId);
+    Ptr<aruco::DetectorParameters> detectorParams = fdcl::get_detector_parameters(config);
+    if(!detectorParams) {
+        return 0;
     }
 
-    if (!opened) {
-        std::cerr << "failed to open video input: " << videoInput << std::endl;
+    VideoCapture inputVideo;
+    if(!fdcl::open_video(inputVideo, config)) {
         return 1;
     }
 
-    Ptr<aruco::Dictionary> dictionary =
-        aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(dictionaryId));
+    Ptr<aruco::Dictionary> dictionary = fdcl::get_dictionary(config);
+    if(!dictionary) {
+        return 1;
+    }
 
     // create board object
     Ptr<aruco::GridBoard> gridboard =
@@ -0,0 +1,34 @@
+# Cross compilation for 64-bit ARM (Cortex-A) Linux boards, with the GNU
+# toolchain of Ubuntu/Debian (g++-aarch64-linux-gnu).
+#
+#   cmake -DCMAKE_TOOLCHAIN_FILE=cmake/aarch64-linux-gnu.cmake \
+#       -DFDCL_EMBEDDED=ON -DOpenCV_DIR=<aarch64 OpenCV>/lib/cmake/opencv4 ..
+#
+# If qemu-user is installed, the executables can be run on the build machine
+# through CMAKE_CROSSCOMPILING_EMULATOR, e.g. with `make benchmark`.
+
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR aarch64)
+
+set(FDCL_CROSS_PREFIX "aarch64-linux-gnu-" CACHE STRING
+    "Prefix of the cross compiler executables")
+set(FDCL_CROSS_ROOT "/usr/aarch64-linux-gnu" CACHE PATH
+    "Root of the target libraries, also used by qemu to load them")
+
+set(CMAKE_C_COMPILER ${FDCL_CROSS_PREFIX}gcc)
+set(CMAKE_CXX_COMPILER ${FDCL_CROSS_PREFIX}g++)
+
+if(DEFINED ENV{FDCL_SYSROOT})
+    set(CMAKE_SYSROOT $ENV{FDCL_SYSROOT})
+endif()
+
+find_program(FDCL_QEMU NAMES qemu-aarch64 qemu-aarch64-static)
+if(FDCL_QEMU)
+    set(CMAKE_CROSSCOMPILING_EMULATOR ${FDCL_QEMU} -L ${FDCL_CROSS_ROOT})
+endif()
+
+list(APPEND CMAKE_FIND_ROOT_PATH ${FDCL_CROSS_ROOT})
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_PACKAGE BOTH)
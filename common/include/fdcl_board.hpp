@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_BOARD_HPP__
+#define __FDCL_BOARD_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace fdcl {
+
+/**
+ * Pose of a GridBoard which stays stable when parts of the board are
+ * occluded or out of the frame.
+ *
+ * The pose of the previous frame predicts where each board marker missing
+ * from the detection should be. Only a small region around each prediction
+ * is searched again, instead of the whole frame like refineDetectedMarkers,
+ * so the recovery costs a few small detections. The board pose is then
+ * refined from the previous one, which keeps it from flipping when only one
+ * or two markers are visible.
+ */
+class BoardTracker {
+public:
+    BoardTracker(const cv::Ptr<cv::aruco::GridBoard> &board,
+        const cv::Ptr<cv::aruco::DetectorParameters> &params,
+        const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs,
+        const bool tracking = true, const float roi_padding = 0.5f,
+        const double max_reprojection_px = 4.0) :
+        board_(board), tracking_(tracking), roi_padding_(roi_padding),
+        max_reprojection_px_(max_reprojection_px), has_pose_(false) {
+
+        camera_matrix.copyTo(camera_matrix_);
+        dist_coeffs.copyTo(dist_coeffs_);
+        set_parameters(params);
+    }
+
+
+    /**
+     * Replaces the detector parameters, e.g. when they are reloaded while
+     * the stream is running.
+     */
+    void set_parameters(
+        const cv::Ptr<cv::aruco::DetectorParameters> &params) {
+
+        // The perimeter rates are relative to the searched region, which is
+        // about the size of the marker.
+        roi_params_ = cv::aruco::DetectorParameters::create();
+        *roi_params_ = *params;
+        roi_params_->minMarkerPerimeterRate = 0.5;
+        roi_params_->maxMarkerPerimeterRate = 4.0;
+    }
+
+
+    /**
+     * Searches the predicted regions of the board markers missing from ids,
+     * and appends the markers found there. Returns the number of markers
+     * recovered.
+     */
+    int recover(const cv::Mat &gray,
+        std::vector<std::vector<cv::Point2f> > &corners,
+        std::vector<int> &ids) {
+
+        if (!tracking_ || !has_pose_) {
+            return 0;
+        }
+
+        cv::Matx33d rotation;
+        cv::Rodrigues(rvec_, rotation);
+
+        const cv::Rect frame(cv::Point(0, 0), gray.size());
+        int recovered = 0;
+
+        for (size_t i = 0; i < board_->ids.size(); i++) {
+            const int id = board_->ids[i];
+            if (std::find(ids.begin(), ids.end(), id) != ids.end()) {
+                continue;
+            }
+
+            // Markers behind the camera cannot be projected.
+            const std::vector<cv::Point3f> &object = board_->objPoints[i];
+            bool in_front = true;
+            for (size_t j = 0; j < object.size(); j++) {
+                const cv::Vec3d p = rotation * cv::Vec3d(object[j].x,
+                    object[j].y, object[j].z) + tvec_;
+                in_front = in_front && p(2) > 0;
+            }
+            if (!in_front) {
+                continue;
+            }
+
+            cv::projectPoints(object, rvec_, tvec_, camera_matrix_,
+                dist_coeffs_, predicted_);
+
+            // A marker partly out of the frame cannot be decoded.
+            cv::Rect region = cv::boundingRect(predicted_);
+            if ((region & frame) != region || region.width < 8 ||
+                region.height < 8) {
+                continue;
+            }
+
+            const int pad = static_cast<int>(roi_padding_ *
+                std::max(region.width, region.height));
+            region -= cv::Point(pad, pad);
+            region += cv::Size(2 * pad, 2 * pad);
+            region &= frame;
+
+            region_corners_.clear();
+            region_ids_.clear();
+            cv::aruco::detectMarkers(gray(region), board_->dictionary,
+                region_corners_, region_ids_, roi_params_);
+
+            for (size_t k = 0; k < region_ids_.size(); k++) {
+                if (region_ids_[k] != id) {
+                    continue;
+                }
+
+                for (size_t j = 0; j < region_corners_[k].size(); j++) {
+                    region_corners_[k][j] += cv::Point2f(region.tl());
+                }
+
+                ids.push_back(id);
+                corners.push_back(region_corners_[k]);
+                recovered++;
+                break;
+            }
+        }
+
+        return recovered;
+    }
+
+
+    /**
+     * Estimates the board pose from the detected markers. Returns false,
+     * and stops tracking, if no board marker is visible.
+     */
+    bool estimate(const std::vector<std::vector<cv::Point2f> > &corners,
+        const std::vector<int> &ids, cv::Vec3d &rvec, cv::Vec3d &tvec) {
+
+        int n_used = 0;
+        if (!ids.empty() && tracking_ && has_pose_) {
+            rvec = rvec_;
+            tvec = tvec_;
+            n_used = cv::aruco::estimatePoseBoard(corners, ids, board_,
+                camera_matrix_, dist_coeffs_, rvec, tvec, true);
+
+            // A fast motion can leave the previous pose too far away for
+            // the refinement to converge.
+            if (n_used > 0 && reprojection_error(corners, ids, rvec, tvec) >
+                max_reprojection_px_) {
+                n_used = 0;
+            }
+        }
+
+        if (!ids.empty() && n_used == 0) {
+            n_used = cv::aruco::estimatePoseBoard(corners, ids, board_,
+                camera_matrix_, dist_coeffs_, rvec, tvec, false);
+        }
+
+        has_pose_ = n_used > 0;
+        if (has_pose_) {
+            rvec_ = rvec;
+            tvec_ = tvec;
+        }
+        return has_pose_;
+    }
+
+private:
+    double reprojection_error(
+        const std::vector<std::vector<cv::Point2f> > &corners,
+        const std::vector<int> &ids, const cv::Vec3d &rvec,
+        const cv::Vec3d &tvec) {
+
+        cv::aruco::getBoardObjectAndImagePoints(board_, corners, ids,
+            object_points_, image_points_);
+        if (object_points_.empty()) {
+            return 0.0;
+        }
+
+        cv::projectPoints(object_points_, rvec, tvec, camera_matrix_,
+            dist_coeffs_, predicted_);
+
+        double sum = 0.0;
+        for (size_t i = 0; i < predicted_.size(); i++) {
+            const cv::Point2f d = predicted_[i] - image_points_[i];
+            sum += d.dot(d);
+        }
+        return std::sqrt(sum / predicted_.size());
+    }
+
+
+    cv::Ptr<cv::aruco::GridBoard> board_;
+    cv::Ptr<cv::aruco::DetectorParameters> roi_params_;
+    cv::Mat camera_matrix_;
+    cv::Mat dist_coeffs_;
+    bool tracking_;
+    float roi_padding_;
+    double max_reprojection_px_;
+
+    bool has_pose_;
+    cv::Vec3d rvec_;
+    cv::Vec3d tvec_;
+
+    std::vector<cv::Point2f> predicted_;
+    std::vector<std::vector<cv::Point2f> > region_corners_;
+    std::vector<int> region_ids_;
+    std::vector<cv::Point3f> object_points_;
+    std::vector<cv::Point2f> image_points_;
+};
+
+}  // namespace fdcl
+
+#endif
@@ -5,6 +5,7 @@
 #include <opencv2/aruco.hpp>
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
 
 namespace fdcl {
     const char* keys  =
@@ -13,9 +14,18 @@ namespace fdcl {
         "DICT_5X5_250=6, DICT_5X5_1000=7, DICT_6X6_50=8, DICT_6X6_100=9, "
         "DICT_6X6_250=10, DICT_6X6_1000=11, DICT_7X7_50=12, DICT_7X7_100=13, "
         "DICT_7X7_250=14, DICT_7X7_1000=15, DICT_ARUCO_ORIGINAL = 16}"
+        "{cd       |      | Custom dictionary file from generate_dictionary, "
+        "overrides -d }"
         "{h        |false | Print help }"
         "{v        |<none>| Custom video source, otherwise '0' }"
         "{l        |      | Actual marker length in meter }"
+        "{ocl      |false | Run image preprocessing through OpenCL (T-API) }"
+        "{cal      |../../calibration_params.yml | Camera calibration file }"
+        "{dp       |      | File of marker detector parameters }"
+        "{t        |-1    | Number of threads used by OpenCV, -1 keeps the "
+        "default }"
+        "{cfg      |      | Pipeline config file; flags given on the command "
+        "line override its values (see pipeline.yml) }"
         ;
 }
 
@@ -84,14 +94,13 @@ bool parse_video_in(cv::VideoCapture &in_video, const cv::CommandLineParser \
 void drawText(cv::InputOutputArray image, const std::string &name, 
     const double value, const cv::Point place)  {
         
-    cv::Scalar text_color = cv::Scalar(0, 252, 124);
+    const cv::Scalar text_color = cv::Scalar(0, 252, 124);
 
-    std::ostringstream vector_to_marker;
-    vector_to_marker.str(std::string());
+    // Format on the stack, this is called for every frame.
+    char text[64];
+    std::snprintf(text, sizeof(text), "%s: %8.4g", name.c_str(), value);
 
-    vector_to_marker << std::setprecision(4) 
-        << name << ": " << std::setw(8) << value;
-    cv::putText(image, vector_to_marker.str(), place, cv::FONT_HERSHEY_SIMPLEX, 
+    cv::putText(image, text, place, cv::FONT_HERSHEY_SIMPLEX, 
         0.6, text_color, 1, CV_AVX);
 }
 
@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_CONFIDENCE_HPP__
+#define __FDCL_CONFIDENCE_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace fdcl {
+
+/**
+ * How well the bits of a detected marker could be read.
+ *
+ * border_error_rate is the fraction of the border cells that do not read as
+ * black. bit_margin is the mean distance of the cell intensities to the
+ * binarization threshold, relative to half the contrast between the black
+ * and the white cells, so it is close to 1 for a sharp, well lit marker and
+ * drops towards 0 with blur and low light. bit_errors is the number of inner
+ * bits that differ from the codeword of the detected id. confidence combines
+ * the three into [0, 1].
+ */
+struct MarkerScore {
+    MarkerScore() : border_error_rate(1.0f), bit_margin(0.0f), bit_errors(0),
+        confidence(0.0f) {}
+
+    float border_error_rate;
+    float bit_margin;
+    int bit_errors;
+    float confidence;
+};
+
+
+class MarkerScorer {
+public:
+    MarkerScorer(const cv::Ptr<cv::aruco::Dictionary> &dictionary,
+        const int border_bits = 1, const int cell_px = 8) :
+        dictionary_(dictionary), border_bits_(border_bits), cell_px_(cell_px) {
+
+        n_cells_ = dictionary_->markerSize + 2 * border_bits_;
+        const float side = static_cast<float>(n_cells_ * cell_px_);
+
+        square_.push_back(cv::Point2f(0, 0));
+        square_.push_back(cv::Point2f(side, 0));
+        square_.push_back(cv::Point2f(side, side));
+        square_.push_back(cv::Point2f(0, side));
+
+        bits_.create(dictionary_->markerSize, dictionary_->markerSize,
+            CV_8UC1);
+        means_.resize(n_cells_ * n_cells_);
+    }
+
+
+    MarkerScore score(const cv::Mat &gray,
+        const std::vector<cv::Point2f> &corners, const int id) {
+
+        MarkerScore result;
+        if (corners.size() != 4) {
+            return result;
+        }
+
+        // Remove the perspective, only the marker pixels are sampled.
+        const int side = n_cells_ * cell_px_;
+        cv::Mat transform = cv::getPerspectiveTransform(corners, square_);
+        cv::warpPerspective(gray, warped_, transform, cv::Size(side, side),
+            cv::INTER_LINEAR);
+
+        const double threshold = cv::threshold(warped_, binary_, 0, 255,
+            cv::THRESH_BINARY | cv::THRESH_OTSU);
+
+        // Mean of each cell, ignoring a margin around it which is mixed
+        // with the neighboring cells.
+        const int margin = std::max(1, cell_px_ / 8);
+        const cv::Size inner(cell_px_ - 2 * margin, cell_px_ - 2 * margin);
+
+        double black_sum = 0.0, white_sum = 0.0;
+        int n_black = 0, n_white = 0;
+        for (int y = 0; y < n_cells_; y++) {
+            for (int x = 0; x < n_cells_; x++) {
+                const cv::Rect cell(x * cell_px_ + margin,
+                    y * cell_px_ + margin, inner.width, inner.height);
+                const double mean = cv::mean(warped_(cell))[0];
+                means_[y * n_cells_ + x] = mean;
+
+                if (mean > threshold) {
+                    white_sum += mean;
+                    n_white++;
+                } else {
+                    black_sum += mean;
+                    n_black++;
+                }
+            }
+        }
+
+        const double contrast = (n_white > 0 && n_black > 0) ?
+            white_sum / n_white - black_sum / n_black : 0.0;
+
+        int border_errors = 0, n_border = 0;
+        double margin_sum = 0.0;
+        for (int y = 0; y < n_cells_; y++) {
+            for (int x = 0; x < n_cells_; x++) {
+                const double mean = means_[y * n_cells_ + x];
+                const bool white = mean > threshold;
+
+                const bool border = x < border_bits_ || y < border_bits_ ||
+                    x >= n_cells_ - border_bits_ ||
+                    y >= n_cells_ - border_bits_;
+
+                if (border) {
+                    n_border++;
+                    if (white) {
+                        border_errors++;
+                    }
+                } else {
+                    bits_.at<uchar>(y - border_bits_, x - border_bits_) =
+                        white ? 1 : 0;
+                }
+
+                if (contrast > 0.0) {
+                    margin_sum += std::min(1.0,
+                        std::abs(mean - threshold) / (0.5 * contrast));
+                }
+            }
+        }
+
+        result.border_error_rate = static_cast<float>(border_errors) /
+            std::max(1, n_border);
+        result.bit_margin = static_cast<float>(margin_sum /
+            (n_cells_ * n_cells_));
+        result.bit_errors = dictionary_->getDistanceToId(bits_, id, true);
+
+        const float correction_budget = static_cast<float>(
+            dictionary_->maxCorrectionBits + 1);
+        const float bit_term = std::max(0.0f,
+            1.0f - result.bit_errors / correction_budget);
+
+        result.confidence = (1.0f - result.border_error_rate) *
+            result.bit_margin * bit_term;
+
+        return result;
+    }
+
+private:
+    cv::Ptr<cv::aruco::Dictionary> dictionary_;
+    int border_bits_;
+    int cell_px_;
+    int n_cells_;
+
+    std::vector<cv::Point2f> square_;
+    std::vector<double> means_;
+    cv::Mat warped_, binary_, bits_;
+};
+
+
+enum RoiEnhancement {
+    ROI_NONE = 0,
+    ROI_NORMALIZE = 1,
+    ROI_SHARPEN = 2,
+};
+
+
+inline bool parse_roi_enhancement(const std::string &name, int &enhancement) {
+    enhancement = ROI_NONE;
+    if (name == "none") {
+        return true;
+    }
+
+    bool known = false;
+    if (name.find("normalize") != std::string::npos) {
+        enhancement |= ROI_NORMALIZE;
+        known = true;
+    }
+    if (name.find("sharpen") != std::string::npos) {
+        enhancement |= ROI_SHARPEN;
+        known = true;
+    }
+
+    return known;
+}
+
+
+/**
+ * Marker detection for blurred and dark images.
+ *
+ * The frame is searched as usual first. Then the candidates that were found
+ * but could not be decoded are searched again, each in a small region around
+ * it, after stretching the contrast and/or sharpening only that region.
+ * Every marker gets a MarkerScore, so marginal detections can be weighted
+ * down instead of discarded.
+ */
+class RobustDetector {
+public:
+    RobustDetector(const cv::Ptr<cv::aruco::Dictionary> &dictionary,
+        const cv::Ptr<cv::aruco::DetectorParameters> &params,
+        const int enhancement, const int max_regions = 32) :
+        dictionary_(dictionary), params_(params), enhancement_(enhancement),
+        max_regions_(max_regions),
+        scorer_(dictionary, params->markerBorderBits),
+        roi_params_(cv::aruco::DetectorParameters::create()) {
+        *roi_params_ = *params;
+    }
+
+
+    /**
+     * Replaces the detector parameters, e.g. when they are reloaded while
+     * the stream is running.
+     */
+    void set_parameters(
+        const cv::Ptr<cv::aruco::DetectorParameters> &params) {
+        params_ = params;
+        *roi_params_ = *params;
+        scorer_ = MarkerScorer(dictionary_, params->markerBorderBits);
+    }
+
+
+    void detect(const cv::Mat &gray,
+        std::vector<std::vector<cv::Point2f> > &corners, std::vector<int> &ids,
+        std::vector<MarkerScore> &scores) {
+
+        rejected_.clear();
+        cv::aruco::detectMarkers(gray, dictionary_, corners, ids, params_,
+            rejected_);
+
+        if (enhancement_ != ROI_NONE) {
+            recover(gray, corners, ids);
+        }
+
+        scores.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            scores[i] = scorer_.score(gray, corners[i], ids[i]);
+        }
+    }
+
+
+    /**
+     * Scores a marker found outside of detect(), e.g. by a BoardTracker.
+     */
+    MarkerScore score(const cv::Mat &gray,
+        const std::vector<cv::Point2f> &corners, const int id) {
+        return scorer_.score(gray, corners, id);
+    }
+
+private:
+    void recover(const cv::Mat &gray,
+        std::vector<std::vector<cv::Point2f> > &corners,
+        std::vector<int> &ids) {
+
+        // Try the largest candidates first, they are the most likely to be
+        // markers rather than noise.
+        order_.resize(rejected_.size());
+        areas_.resize(rejected_.size());
+        for (size_t i = 0; i < rejected_.size(); i++) {
+            order_[i] = static_cast<int>(i);
+            areas_[i] = cv::contourArea(rejected_[i]);
+        }
+        std::sort(order_.begin(), order_.end(), [this](int a, int b) {
+            return areas_[a] > areas_[b];
+        });
+
+        const cv::Rect frame(cv::Point(0, 0), gray.size());
+        const int frame_side = std::max(gray.cols, gray.rows);
+        const size_t n_regions = std::min(order_.size(),
+            static_cast<size_t>(max_regions_));
+
+        for (size_t k = 0; k < n_regions; k++) {
+            cv::Rect region = cv::boundingRect(rejected_[order_[k]]);
+            const int pad = std::max(8, std::max(region.width,
+                region.height) / 4);
+            region -= cv::Point(pad, pad);
+            region += cv::Size(2 * pad, 2 * pad);
+            region &= frame;
+            if (region.area() == 0) {
+                continue;
+            }
+
+            enhance(gray(region), enhanced_);
+
+            // The perimeter rates are relative to the largest side of the
+            // searched image, so they are rescaled to keep the marker sizes
+            // in pixels that the frame pass accepts.
+            const double scale = static_cast<double>(frame_side) /
+                std::max(region.width, region.height);
+            roi_params_->minMarkerPerimeterRate =
+                params_->minMarkerPerimeterRate * scale;
+            roi_params_->maxMarkerPerimeterRate = std::max(
+                roi_params_->minMarkerPerimeterRate,
+                std::min(params_->maxMarkerPerimeterRate * scale, 4.0));
+
+            region_corners_.clear();
+            region_ids_.clear();
+            cv::aruco::detectMarkers(enhanced_, dictionary_, region_corners_,
+                region_ids_, roi_params_);
+
+            for (size_t i = 0; i < region_ids_.size(); i++) {
+                if (std::find(ids.begin(), ids.end(), region_ids_[i]) !=
+                    ids.end()) {
+                    continue;
+                }
+
+                for (size_t j = 0; j < region_corners_[i].size(); j++) {
+                    region_corners_[i][j] += cv::Point2f(region.tl());
+                }
+
+                ids.push_back(region_ids_[i]);
+                corners.push_back(region_corners_[i]);
+            }
+        }
+    }
+
+
+    void enhance(const cv::Mat &roi, cv::Mat &out) {
+        if (enhancement_ & ROI_NORMALIZE) {
+            cv::normalize(roi, out, 0, 255, cv::NORM_MINMAX);
+        } else {
+            roi.copyTo(out);
+        }
+
+        // Unsharp mask
+        if (enhancement_ & ROI_SHARPEN) {
+            cv::GaussianBlur(out, blurred_, cv::Size(0, 0), 1.5);
+            cv::addWeighted(out, 1.5, blurred_, -0.5, 0, out);
+        }
+    }
+
+
+    cv::Ptr<cv::aruco::Dictionary> dictionary_;
+    cv::Ptr<cv::aruco::DetectorParameters> params_;
+    int enhancement_;
+    int max_regions_;
+    MarkerScorer scorer_;
+    cv::Ptr<cv::aruco::DetectorParameters> roi_params_;
+
+    std::vector<std::vector<cv::Point2f> > rejected_, region_corners_;
+    std::vector<int> region_ids_, order_;
+    std::vector<double> areas_;
+    cv::Mat enhanced_, blurred_;
+};
+
+}  // namespace fdcl
+
+#endif
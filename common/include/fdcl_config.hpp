@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_CONFIG_HPP__
+#define __FDCL_CONFIG_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <set>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "fdcl_common.hpp"
+#include "fdcl_dictionary.hpp"
+
+namespace fdcl {
+
+/**
+ * Reads the value of key if the node has it, and leaves value untouched
+ * otherwise, so that a file only needs to list what it changes.
+ */
+template <typename T>
+inline void read_if_present(const cv::FileNode &node, const char *key,
+    T &value) {
+
+    const cv::FileNode child = node[key];
+    if (!child.empty()) {
+        child >> value;
+    }
+}
+
+
+/**
+ * Flags are either numbers, or true/false, yes/no and on/off, which
+ * FileStorage keeps as strings. Anything else is an error rather than
+ * silently false.
+ */
+inline void read_if_present(const cv::FileNode &node, const char *key,
+    bool &value) {
+
+    const cv::FileNode child = node[key];
+    if (child.empty()) {
+        return;
+    }
+
+    if (child.isInt() || child.isReal()) {
+        value = static_cast<double>(child) != 0;
+        return;
+    }
+
+    if (child.isString()) {
+        std::string text = static_cast<std::string>(child);
+        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+        if (text == "true" || text == "yes" || text == "on" || text == "1") {
+            value = true;
+            return;
+        }
+        if (text == "false" || text == "no" || text == "off" ||
+            text == "0") {
+            value = false;
+            return;
+        }
+    }
+
+    CV_Error(cv::Error::StsParseError, std::string("Key ") + key +
+        " must be a flag: 0, 1, true, false, yes, no, on or off");
+}
+
+
+inline void read_if_present(const cv::FileNode &node, const char *key,
+    std::string &value) {
+
+    const cv::FileNode child = node[key];
+    if (!child.empty()) {
+        value = static_cast<std::string>(child);
+    }
+}
+
+
+/**
+ * Reads the marker detector parameters from a node which has the same keys
+ * as camera_calibration/detector_params.yml. The parameters which are not
+ * in the node keep their value.
+ */
+inline void read_detector_parameters(const cv::FileNode &node,
+    cv::Ptr<cv::aruco::DetectorParameters> &params) {
+
+    read_if_present(node, "adaptiveThreshWinSizeMin",
+        params->adaptiveThreshWinSizeMin);
+    read_if_present(node, "adaptiveThreshWinSizeMax",
+        params->adaptiveThreshWinSizeMax);
+    read_if_present(node, "adaptiveThreshWinSizeStep",
+        params->adaptiveThreshWinSizeStep);
+    read_if_present(node, "adaptiveThreshConstant",
+        params->adaptiveThreshConstant);
+    read_if_present(node, "minMarkerPerimeterRate",
+        params->minMarkerPerimeterRate);
+    read_if_present(node, "maxMarkerPerimeterRate",
+        params->maxMarkerPerimeterRate);
+    read_if_present(node, "polygonalApproxAccuracyRate",
+        params->polygonalApproxAccuracyRate);
+    read_if_present(node, "minCornerDistanceRate",
+        params->minCornerDistanceRate);
+    read_if_present(node, "minDistanceToBorder",
+        params->minDistanceToBorder);
+    read_if_present(node, "minMarkerDistanceRate",
+        params->minMarkerDistanceRate);
+    read_if_present(node, "cornerRefinementMethod",
+        params->cornerRefinementMethod);
+    read_if_present(node, "cornerRefinementWinSize",
+        params->cornerRefinementWinSize);
+    read_if_present(node, "cornerRefinementMaxIterations",
+        params->cornerRefinementMaxIterations);
+    read_if_present(node, "cornerRefinementMinAccuracy",
+        params->cornerRefinementMinAccuracy);
+    read_if_present(node, "markerBorderBits", params->markerBorderBits);
+    read_if_present(node, "perspectiveRemovePixelPerCell",
+        params->perspectiveRemovePixelPerCell);
+    read_if_present(node, "perspectiveRemoveIgnoredMarginPerCell",
+        params->perspectiveRemoveIgnoredMarginPerCell);
+    read_if_present(node, "maxErroneousBitsInBorderRate",
+        params->maxErroneousBitsInBorderRate);
+    read_if_present(node, "minOtsuStdDev", params->minOtsuStdDev);
+    read_if_present(node, "errorCorrectionRate",
+        params->errorCorrectionRate);
+}
+
+
+/**
+ * Reads the marker detector parameters from a file, either at its top level
+ * or under node_name.
+ */
+inline bool read_detector_parameters(const std::string &filename,
+    cv::Ptr<cv::aruco::DetectorParameters> &params,
+    const std::string &node_name = "") {
+
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        return false;
+    }
+
+    const cv::FileNode node = node_name.empty() ? fs.root() : fs[node_name];
+    if (node.empty()) {
+        return false;
+    }
+
+    read_detector_parameters(node, params);
+    return true;
+}
+
+
+/**
+ * Everything a pipeline needs, from the source to the sinks.
+ *
+ * The defaults are the command line defaults. A pipeline config file (see
+ * pipeline.yml at the root of the repository) only overrides the keys it
+ * has, so it can be as short as needed.
+ */
+struct PipelineConfig {
+    PipelineConfig() : replay_as_fast(false), latest_frame(false),
+        max_frame_age_ms(0.0), calibration("../../calibration_params.yml"),
+        dictionary(16), marker_length(0.0f), undistort(false), robust(false),
+        robust_enhancement("normalize"), charuco_squares_x(0),
+        charuco_squares_y(0), charuco_square_length(0.0f),
+        board_markers_x(0), board_markers_y(0), board_marker_separation(0.0f),
+        board_tracking(true), board_roi_padding(0.5f), threads(-1),
+        opencl(false), display(true), output_video("out.avi"),
+        output_fps(0.0), shm_slots(4), metrics_port(0) {}
+
+    // Config file this was loaded from, if any
+    std::string path;
+
+    // Source: a camera id or a video file or URL, "" for camera 0
+    std::string video;
+    std::string replay;
+    bool replay_as_fast;
+    bool latest_frame;
+    double max_frame_age_ms;
+
+    // Multi-view rig from camera_calibration_extrinsics, and the comma
+    // separated sources of its cameras
+    std::string rig;
+    std::string videos;
+
+    // Camera calibration from camera_calibration
+    std::string calibration;
+
+    // Markers
+    int dictionary;
+    std::string custom_dictionary;
+    float marker_length;
+
+    // Detector parameters file, and the node they are under in that file,
+    // empty for the top level
+    std::string detector_params;
+    std::string detector_node;
+
+    // Stages
+    bool undistort;
+    bool robust;
+    std::string robust_enhancement;
+    int charuco_squares_x;
+    int charuco_squares_y;
+    float charuco_square_length;
+    int board_markers_x;
+    int board_markers_y;
+    float board_marker_separation;
+    bool board_tracking;
+    float board_roi_padding;
+
+    // Performance modes, threads < 0 keeps the OpenCV default
+    int threads;
+    bool opencl;
+
+    // Sinks, output_fps <= 0 uses the rate of the source
+    bool display;
+    std::string output_video;
+    double output_fps;
+    std::string shm;
+    int shm_slots;
+    std::string record;
+    int metrics_port;
+    std::string metrics_file;
+};
+
+
+/**
+ * Command line values applied on top of a pipeline config.
+ *
+ * Without a config file, every key which has a value applies, including the
+ * defaults of the keys. With a config file, only the keys given explicitly
+ * on the command line override the file, so that e.g.
+ * `--cfg=pipeline.yml -v=video.mp4` replaces only the source.
+ */
+class CommandLineArgs {
+public:
+    CommandLineArgs(const cv::CommandLineParser &parser, const int argc,
+        const char *const *argv, const PipelineConfig &config) :
+        parser_(parser), from_file_(!config.path.empty()) {
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (arg.size() < 2 || arg[0] != '-') {
+                continue;
+            }
+
+            // Skips separators made only of dashes, e.g. "--".
+            const size_t start = arg.find_first_not_of('-');
+            if (start == std::string::npos) {
+                continue;
+            }
+
+            arg = arg.substr(start);
+            given_.insert(arg.substr(0, arg.find('=')));
+        }
+    }
+
+
+    bool has(const std::string &key) const {
+        if (from_file_) {
+            return given_.count(key) > 0;
+        }
+        return parser_.has(key);
+    }
+
+
+    /**
+     * Reads the value of key if it applies, and leaves value untouched
+     * otherwise.
+     */
+    template <typename T>
+    bool read(const std::string &key, T &value) const {
+        if (!has(key)) {
+            return false;
+        }
+        value = parser_.get<T>(key);
+        return true;
+    }
+
+
+    const cv::CommandLineParser &parser() const {
+        return parser_;
+    }
+
+private:
+    const cv::CommandLineParser &parser_;
+    bool from_file_;
+    std::set<std::string> given_;
+};
+
+
+/**
+ * Reads the keys shared by the pipeline tools (fdcl::keys) into config.
+ */
+inline void read_common_args(const CommandLineArgs &args,
+    PipelineConfig &config) {
+
+    args.read("v", config.video);
+    args.read("cd", config.custom_dictionary);
+    if (args.read("dp", config.detector_params)) {
+        config.detector_node = "";
+    }
+    args.read("l", config.marker_length);
+    args.read("d", config.dictionary);
+    args.read("cal", config.calibration);
+    args.read("t", config.threads);
+    args.read("ocl", config.opencl);
+}
+
+
+/**
+ * Overrides config with the keys present in a pipeline config file.
+ */
+inline bool load_pipeline_config(const std::string &path,
+    PipelineConfig &config) {
+
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to open pipeline config " << path << "\n";
+        return false;
+    }
+    config.path = path;
+
+    // A key of the wrong type throws, e.g. a flag which is not a number or
+    // true/false.
+    try {
+        const cv::FileNode source = fs["source"];
+        read_if_present(source, "video", config.video);
+        read_if_present(source, "replay", config.replay);
+        read_if_present(source, "replay_as_fast", config.replay_as_fast);
+        read_if_present(source, "latest_frame", config.latest_frame);
+        read_if_present(source, "max_frame_age_ms", config.max_frame_age_ms);
+        read_if_present(source, "rig", config.rig);
+        read_if_present(source, "videos", config.videos);
+
+        read_if_present(fs.root(), "calibration", config.calibration);
+
+        const cv::FileNode markers = fs["markers"];
+        read_if_present(markers, "dictionary", config.dictionary);
+        read_if_present(markers, "custom_dictionary",
+            config.custom_dictionary);
+        read_if_present(markers, "length", config.marker_length);
+
+        // The detector parameters are either inline, which keeps the whole
+        // pipeline in one file, or in a separate file.
+        read_if_present(fs.root(), "detector_params",
+            config.detector_params);
+        if (!fs["detector"].empty()) {
+            config.detector_params = path;
+            config.detector_node = "detector";
+        }
+
+        const cv::FileNode stages = fs["stages"];
+        read_if_present(stages, "undistort", config.undistort);
+        read_if_present(stages, "robust", config.robust);
+        read_if_present(stages, "robust_enhancement",
+            config.robust_enhancement);
+        const cv::FileNode charuco = stages["charuco"];
+        read_if_present(charuco, "squares_x", config.charuco_squares_x);
+        read_if_present(charuco, "squares_y", config.charuco_squares_y);
+        read_if_present(charuco, "square_length",
+            config.charuco_square_length);
+        const cv::FileNode board = stages["board"];
+        read_if_present(board, "markers_x", config.board_markers_x);
+        read_if_present(board, "markers_y", config.board_markers_y);
+        read_if_present(board, "marker_separation",
+            config.board_marker_separation);
+        read_if_present(board, "tracking", config.board_tracking);
+        read_if_present(board, "roi_padding", config.board_roi_padding);
+
+        const cv::FileNode performance = fs["performance"];
+        read_if_present(performance, "threads", config.threads);
+        read_if_present(performance, "opencl", config.opencl);
+
+        const cv::FileNode sinks = fs["sinks"];
+        read_if_present(sinks, "display", config.display);
+        read_if_present(sinks, "output_video", config.output_video);
+        read_if_present(sinks, "output_fps", config.output_fps);
+        read_if_present(sinks, "shm", config.shm);
+        read_if_present(sinks, "shm_slots", config.shm_slots);
+        read_if_present(sinks, "record", config.record);
+        read_if_present(sinks, "metrics_port", config.metrics_port);
+        read_if_present(sinks, "metrics_file", config.metrics_file);
+    } catch (const cv::Exception &e) {
+        std::cerr << "Invalid pipeline config " << path << ": " << e.err
+            << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Loads the pipeline config file given with --cfg, if any. The command line
+ * is then applied on top of it with CommandLineArgs.
+ */
+inline bool parse_pipeline_config(const cv::CommandLineParser &parser,
+    PipelineConfig &config) {
+
+    if (!parser.has("cfg")) {
+        return true;
+    }
+
+    return load_pipeline_config(parser.get<cv::String>("cfg"), config);
+}
+
+
+inline bool open_video(cv::VideoCapture &in_video,
+    const PipelineConfig &config) {
+
+    const std::string video_input = config.video.empty() ? "0" : config.video;
+    open_video_from_arg(video_input, in_video);
+
+    if (!in_video.isOpened()) {
+        std::cerr << "Failed to open video input: " << video_input << "\n";
+        return false;
+    }
+
+    std::cout << "Video input " << video_input << " successfully opened\n";
+    return true;
+}
+
+
+inline cv::Ptr<cv::aruco::Dictionary> get_dictionary(
+    const PipelineConfig &config) {
+    return get_dictionary(config.dictionary, config.custom_dictionary);
+}
+
+
+inline bool read_camera_parameters(const PipelineConfig &config,
+    cv::Mat &camera_matrix, cv::Mat &dist_coeffs) {
+
+    cv::FileStorage fs(config.calibration, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to open the camera calibration "
+            << config.calibration << "\n";
+        return false;
+    }
+
+    fs["camera_matrix"] >> camera_matrix;
+    fs["distortion_coefficients"] >> dist_coeffs;
+
+    // Undistortion and pose estimation assert on a missing calibration.
+    if (camera_matrix.rows != 3 || camera_matrix.cols != 3 ||
+        dist_coeffs.empty()) {
+        std::cerr << "The camera calibration " << config.calibration
+            << " has no valid camera_matrix and distortion_coefficients\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+inline cv::Ptr<cv::aruco::DetectorParameters> get_detector_parameters(
+    const PipelineConfig &config) {
+
+    cv::Ptr<cv::aruco::DetectorParameters> params =
+        cv::aruco::DetectorParameters::create();
+
+    if (!config.detector_params.empty() &&
+        !read_detector_parameters(config.detector_params, params,
+            config.detector_node)) {
+        std::cerr << "Invalid detector parameters file "
+            << config.detector_params << "\n";
+        return cv::Ptr<cv::aruco::DetectorParameters>();
+    }
+
+    return params;
+}
+
+
+inline void apply_performance_modes(const PipelineConfig &config) {
+    if (config.threads >= 0) {
+        cv::setNumThreads(config.threads);
+    }
+}
+
+
+/**
+ * Reloads the detector parameters when their file changes, so that they can
+ * be tuned on a running stream. The file is only checked every interval_ms,
+ * and a file which fails to parse keeps the current parameters.
+ */
+class DetectorParamsReloader {
+public:
+    DetectorParamsReloader(const PipelineConfig &config,
+        const int interval_ms = 500) : path_(config.detector_params),
+        node_(config.detector_node), interval_ms_(interval_ms),
+        mtime_ns_(modified_ns()), last_check_(clock::now()) {}
+
+
+    /**
+     * Returns true and the new parameters if they were reloaded.
+     */
+    bool poll(cv::Ptr<cv::aruco::DetectorParameters> &params) {
+        if (path_.empty()) {
+            return false;
+        }
+
+        const clock::time_point now = clock::now();
+        if (now - last_check_ < std::chrono::milliseconds(interval_ms_)) {
+            return false;
+        }
+        last_check_ = now;
+
+        const int64_t mtime_ns = modified_ns();
+        if (mtime_ns == mtime_ns_) {
+            return false;
+        }
+        mtime_ns_ = mtime_ns;
+
+        cv::Ptr<cv::aruco::DetectorParameters> reloaded =
+            cv::aruco::DetectorParameters::create();
+        try {
+            if (!read_detector_parameters(path_, reloaded, node_)) {
+                return false;
+            }
+        } catch (const cv::Exception &) {
+            std::cerr << "Keeping the detector parameters, failed to parse "
+                << path_ << "\n";
+            return false;
+        }
+
+        params = reloaded;
+        std::cout << "Reloaded the detector parameters from " << path_ << "\n";
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    int64_t modified_ns() const {
+        struct stat info;
+        if (stat(path_.c_str(), &info) != 0) {
+            return 0;
+        }
+        return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+            info.st_mtim.tv_nsec;
+    }
+
+
+    std::string path_;
+    std::string node_;
+    int interval_ms_;
+    int64_t mtime_ns_;
+    clock::time_point last_check_;
+};
+
+}  // namespace fdcl
+
+#endif
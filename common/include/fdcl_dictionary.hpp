@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_DICTIONARY_HPP__
+#define __FDCL_DICTIONARY_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+#include <opencv2/core/hal/hal.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fdcl {
+
+/**
+ * Smallest Hamming distance between any two markers of the dictionary, over
+ * all their rotations, and between each marker and its own rotations. A
+ * dictionary corrects up to (distance - 1) / 2 bits.
+ */
+inline int min_hamming_distance(const cv::aruco::Dictionary &dictionary) {
+    const cv::Mat &bytes_list = dictionary.bytesList;
+    const int n_markers = bytes_list.rows;
+    const int n_bytes = bytes_list.cols;
+    if (n_markers == 0) {
+        return 0;
+    }
+
+    // bytesList holds the 4 rotations of each byte as 4 channels.
+    std::vector<std::vector<uchar> > rotations(4 * n_markers,
+        std::vector<uchar>(n_bytes));
+    for (int i = 0; i < n_markers; i++) {
+        const uchar *row = bytes_list.ptr<uchar>(i);
+        for (int r = 0; r < 4; r++) {
+            for (int k = 0; k < n_bytes; k++) {
+                rotations[4 * i + r][k] = row[4 * k + r];
+            }
+        }
+    }
+
+    const int max_distance = dictionary.markerSize * dictionary.markerSize;
+    std::vector<int> row_min(n_markers, max_distance);
+
+    cv::parallel_for_(cv::Range(0, n_markers), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            const std::vector<uchar> &a = rotations[4 * i];
+            int distance = max_distance;
+
+            for (int j = i; j < n_markers; j++) {
+                for (int r = (j == i ? 1 : 0); r < 4; r++) {
+                    const std::vector<uchar> &b = rotations[4 * j + r];
+                    distance = std::min(distance,
+                        cv::hal::normHamming(a.data(), b.data(), n_bytes));
+                }
+            }
+
+            row_min[i] = distance;
+        }
+    });
+
+    return *std::min_element(row_min.begin(), row_min.end());
+}
+
+
+/**
+ * Saves a dictionary in the same format as
+ * cv::aruco::Dictionary::writeDictionary in newer OpenCV versions, with each
+ * marker stored as a string of bits.
+ */
+inline bool save_dictionary(const std::string &path,
+    const cv::aruco::Dictionary &dictionary, const int min_distance) {
+
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        return false;
+    }
+
+    const int n_markers = dictionary.bytesList.rows;
+    fs << "nmarkers" << n_markers;
+    fs << "markersize" << dictionary.markerSize;
+    fs << "maxCorrectionBits" << dictionary.maxCorrectionBits;
+    fs << "minHammingDistance" << min_distance;
+
+    for (int i = 0; i < n_markers; i++) {
+        cv::Mat bits = cv::aruco::Dictionary::getBitsFromByteList(
+            dictionary.bytesList.rowRange(i, i + 1), dictionary.markerSize);
+
+        std::string bit_string(bits.total(), '0');
+        for (size_t k = 0; k < bits.total(); k++) {
+            if (bits.ptr<uchar>()[k]) {
+                bit_string[k] = '1';
+            }
+        }
+
+        fs << "marker_" + std::to_string(i) << bit_string;
+    }
+
+    return true;
+}
+
+
+inline cv::Ptr<cv::aruco::Dictionary> read_dictionary(
+    const std::string &path) {
+
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to open dictionary file " << path << "\n";
+        return cv::Ptr<cv::aruco::Dictionary>();
+    }
+
+    int n_markers = 0, marker_size = 0, max_correction_bits = 0;
+    fs["nmarkers"] >> n_markers;
+    fs["markersize"] >> marker_size;
+    fs["maxCorrectionBits"] >> max_correction_bits;
+
+    if (n_markers <= 0 || marker_size <= 0) {
+        std::cerr << "Invalid dictionary file " << path << "\n";
+        return cv::Ptr<cv::aruco::Dictionary>();
+    }
+
+    cv::Mat bytes_list;
+    cv::Mat bits(marker_size, marker_size, CV_8UC1);
+    for (int i = 0; i < n_markers; i++) {
+        std::string bit_string;
+        fs["marker_" + std::to_string(i)] >> bit_string;
+
+        if (bit_string.size() != bits.total()) {
+            std::cerr << "Invalid marker " << i << " in dictionary file "
+                << path << "\n";
+            return cv::Ptr<cv::aruco::Dictionary>();
+        }
+
+        for (size_t k = 0; k < bits.total(); k++) {
+            bits.ptr<uchar>()[k] = bit_string[k] == '1' ? 1 : 0;
+        }
+
+        bytes_list.push_back(cv::aruco::Dictionary::getByteListFromBits(bits));
+    }
+
+    return cv::makePtr<cv::aruco::Dictionary>(bytes_list, marker_size,
+        max_correction_bits);
+}
+
+
+/**
+ * The custom dictionary file if one is given, otherwise the predefined
+ * dictionary with the given id.
+ */
+inline cv::Ptr<cv::aruco::Dictionary> get_dictionary(const int id,
+    const std::string &custom_path) {
+
+    if (!custom_path.empty()) {
+        return read_dictionary(custom_path);
+    }
+
+    return cv::aruco::getPredefinedDictionary(
+        cv::aruco::PREDEFINED_DICTIONARY_NAME(id));
+}
+
+
+/**
+ * Dictionary selected on the command line: the custom dictionary file given
+ * with -cd if any, otherwise the predefined dictionary given with -d. Fails
+ * when neither is given, or when -d is not a number.
+ */
+inline cv::Ptr<cv::aruco::Dictionary> get_dictionary(
+    const cv::CommandLineParser &parser) {
+
+    if (parser.has("cd")) {
+        return read_dictionary(parser.get<cv::String>("cd"));
+    }
+
+    if (!parser.has("d")) {
+        std::cerr << "Missing parameter 'd', or a custom dictionary with "
+            "-cd\n";
+        return cv::Ptr<cv::aruco::Dictionary>();
+    }
+
+    const int id = parser.get<int>("d");
+    if (!parser.check()) {
+        parser.printErrors();
+        return cv::Ptr<cv::aruco::Dictionary>();
+    }
+
+    return get_dictionary(id, cv::String());
+}
+
+}  // namespace fdcl
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_FRAME_HPP__
+#define __FDCL_FRAME_HPP__
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace fdcl {
+
+/**
+ * Nanoseconds of the monotonic clock, which is shared by all the processes
+ * on the machine.
+ */
+inline int64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * A captured frame with its timestamps.
+ *
+ * capture_ns is the monotonic time the frame was grabbed, and position_ms is
+ * the timestamp reported by the source (CAP_PROP_POS_MSEC). Both are kept
+ * from the recording when a session is replayed. arrival_ns is the monotonic
+ * time the frame entered this process, which is the capture time for live
+ * sources, and is what output latencies are measured from.
+ */
+struct Frame {
+    Frame() : id(0), capture_ns(0), arrival_ns(0), position_ms(0.0) {}
+
+    cv::Mat image;
+    uint64_t id;
+    int64_t capture_ns;
+    int64_t arrival_ns;
+    double position_ms;
+};
+
+
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    /**
+     * Reads the next frame. If frame.image already has the size and the type
+     * of the next frame, it is filled in place.
+     */
+    virtual bool read(Frame &frame) = 0;
+
+    /**
+     * Number of frames the source failed to deliver so far.
+     */
+    virtual uint64_t errors() const { return 0; }
+
+    /**
+     * Number of frames which were captured but never delivered, because a
+     * newer frame replaced them.
+     */
+    virtual uint64_t skipped() const { return 0; }
+
+    /**
+     * Number of frames which were dropped because they were older than the
+     * maximum frame age.
+     */
+    virtual uint64_t stale() const { return 0; }
+};
+
+
+class CaptureSource : public FrameSource {
+public:
+    explicit CaptureSource(cv::VideoCapture &in_video,
+        const int max_retries = 3) : in_video_(in_video), next_id_(0),
+        errors_(0), max_retries_(max_retries) {}
+
+    /**
+     * A frame which is grabbed but cannot be decoded is counted as an error
+     * and the next one is grabbed, up to max_retries times in a row.
+     */
+    bool read(Frame &frame) {
+        for (int attempt = 0; attempt <= max_retries_; attempt++) {
+            if (!in_video_.grab()) {
+                return false;
+            }
+
+            frame.capture_ns = monotonic_ns();
+            frame.arrival_ns = frame.capture_ns;
+            frame.position_ms = in_video_.get(cv::CAP_PROP_POS_MSEC);
+            frame.id = next_id_++;
+
+            if (in_video_.retrieve(frame.image) && !frame.image.empty()) {
+                return true;
+            }
+            errors_++;
+        }
+
+        return false;
+    }
+
+    uint64_t errors() const { return errors_; }
+
+private:
+    cv::VideoCapture &in_video_;
+    uint64_t next_id_;
+    uint64_t errors_;
+    int max_retries_;
+};
+
+
+/**
+ * "Latest frame wins" capture from a live source.
+ *
+ * A grabber thread reads the source as fast as it delivers frames, so that
+ * the capture buffer never fills with stale frames, and only keeps the
+ * newest one. read() waits for a frame newer than the last one it returned,
+ * and drops it if it is older than max_age_ms (0 keeps every frame). This
+ * trades frame rate for latency when the processing is slower than the
+ * camera.
+ */
+class LatestFrameSource : public FrameSource {
+public:
+    explicit LatestFrameSource(cv::VideoCapture &in_video,
+        const double max_age_ms = 0.0) : in_video_(in_video),
+        max_age_ns_(static_cast<int64_t>(max_age_ms * 1e6)), has_new_(false),
+        finished_(false), running_(true), errors_(0), skipped_(0), stale_(0) {
+        thread_ = std::thread(&LatestFrameSource::grab, this);
+    }
+
+    ~LatestFrameSource() {
+        running_.store(false);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+
+    bool read(Frame &frame) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;) {
+                ready_.wait(lock, [this] { return has_new_ || finished_; });
+                if (!has_new_) {
+                    return false;
+                }
+
+                has_new_ = false;
+                std::swap(latest_, taken_);
+
+                if (max_age_ns_ > 0 &&
+                    monotonic_ns() - taken_.capture_ns > max_age_ns_) {
+                    stale_++;
+                    continue;
+                }
+                break;
+            }
+        }
+
+        // The copy is done outside the lock, so the grabber is not blocked,
+        // and into frame.image so that a buffer given by the caller is kept.
+        frame.id = taken_.id;
+        frame.capture_ns = taken_.capture_ns;
+        frame.arrival_ns = taken_.arrival_ns;
+        frame.position_ms = taken_.position_ms;
+        taken_.image.copyTo(frame.image);
+
+        return true;
+    }
+
+    uint64_t errors() const { return errors_.load(); }
+    uint64_t skipped() const { return skipped_.load(); }
+    uint64_t stale() const { return stale_.load(); }
+
+private:
+    void grab() {
+        uint64_t next_id = 0;
+        while (running_.load()) {
+            if (!in_video_.grab()) {
+                break;
+            }
+
+            grabbed_.capture_ns = monotonic_ns();
+            grabbed_.arrival_ns = grabbed_.capture_ns;
+            grabbed_.position_ms = in_video_.get(cv::CAP_PROP_POS_MSEC);
+            grabbed_.id = next_id++;
+
+            if (!in_video_.retrieve(grabbed_.image) || grabbed_.image.empty()) {
+                errors_++;
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (has_new_) {
+                    skipped_++;
+                }
+                std::swap(grabbed_, latest_);
+                has_new_ = true;
+            }
+            ready_.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+        }
+        ready_.notify_one();
+    }
+
+
+    cv::VideoCapture &in_video_;
+    int64_t max_age_ns_;
+
+    // The three frames rotate between the grabber (grabbed_), the newest
+    // unread frame (latest_), and the last frame read (taken_), so their
+    // buffers are reused once the frame size is known.
+    Frame grabbed_;
+    Frame latest_;
+    Frame taken_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool has_new_;
+    bool finished_;
+
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> errors_;
+    std::atomic<uint64_t> skipped_;
+    std::atomic<uint64_t> stale_;
+    std::thread thread_;
+};
+
+
+/**
+ * Record files start with record_magic, followed by a RecordHeader and the
+ * raw (continuous) pixels of each frame.
+ */
+const char record_magic[8] = {'F', 'D', 'C', 'L', 'R', 'E', 'C', '1'};
+
+// Largest frame side accepted when replaying, in pixels
+const int32_t record_max_side = 16384;
+
+
+struct RecordHeader {
+    uint64_t id;
+    int64_t capture_ns;
+    double position_ms;
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t reserved;
+};
+
+
+class FrameRecorder {
+public:
+    bool open(const std::string &path) {
+        out_.open(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            std::cerr << "Failed to open record file " << path << "\n";
+            return false;
+        }
+
+        out_.write(record_magic, sizeof(record_magic));
+        return static_cast<bool>(out_);
+    }
+
+
+    bool is_open() const {
+        return out_.is_open();
+    }
+
+
+    bool write(const Frame &frame) {
+        RecordHeader header;
+        header.id = frame.id;
+        header.capture_ns = frame.capture_ns;
+        header.position_ms = frame.position_ms;
+        header.rows = frame.image.rows;
+        header.cols = frame.image.cols;
+        header.type = frame.image.type();
+        header.reserved = 0;
+
+        out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+        if (frame.image.isContinuous()) {
+            out_.write(reinterpret_cast<const char *>(frame.image.data),
+                frame.image.total() * frame.image.elemSize());
+        } else {
+            const size_t row_bytes = frame.image.cols * frame.image.elemSize();
+            for (int i = 0; i < frame.image.rows; i++) {
+                out_.write(reinterpret_cast<const char *>(frame.image.ptr(i)),
+                    row_bytes);
+            }
+        }
+
+        return static_cast<bool>(out_);
+    }
+
+private:
+    std::ofstream out_;
+};
+
+
+/**
+ * Replays a record file, either at the pacing of the recording or as fast
+ * as possible. The frames and their recorded timestamps are the same on
+ * every replay, so the results only depend on the recording.
+ */
+class ReplaySource : public FrameSource {
+public:
+    ReplaySource() : realtime_(true), first_capture_ns_(0), start_ns_(0),
+        started_(false), file_size_(0) {}
+
+    bool open(const std::string &path, const bool realtime) {
+        in_.open(path.c_str(), std::ios::binary | std::ios::ate);
+        if (!in_) {
+            std::cerr << "Failed to open record file " << path << "\n";
+            return false;
+        }
+        file_size_ = static_cast<uint64_t>(in_.tellg());
+        in_.seekg(0);
+
+        char magic[sizeof(record_magic)];
+        in_.read(magic, sizeof(magic));
+        if (!in_ || std::memcmp(magic, record_magic, sizeof(magic)) != 0) {
+            std::cerr << path << " is not a record file\n";
+            return false;
+        }
+
+        realtime_ = realtime;
+        started_ = false;
+        return true;
+    }
+
+
+    /**
+     * Returns false at the end of the recording, and with a message if the
+     * recording is truncated or corrupt.
+     */
+    bool read(Frame &frame) {
+        RecordHeader header;
+        in_.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if (in_.gcount() == 0) {
+            return false;
+        }
+        if (!in_) {
+            std::cerr << "Truncated record file, incomplete frame header\n";
+            return false;
+        }
+
+        // The header comes from the file, so it is checked before it sizes
+        // anything.
+        if (header.rows <= 0 || header.cols <= 0 ||
+            header.rows > record_max_side || header.cols > record_max_side ||
+            (header.type != CV_8UC1 && header.type != CV_8UC3)) {
+            std::cerr << "Corrupt record file, frame " << header.id
+                << " has an invalid size " << header.cols << "x"
+                << header.rows << " or type " << header.type << "\n";
+            return false;
+        }
+
+        const uint64_t payload = static_cast<uint64_t>(header.rows) *
+            header.cols * CV_ELEM_SIZE(header.type);
+        const uint64_t position = static_cast<uint64_t>(in_.tellg());
+        if (position > file_size_ || file_size_ - position < payload) {
+            std::cerr << "Truncated record file, frame " << header.id
+                << " needs " << payload << " bytes\n";
+            return false;
+        }
+
+        frame.image.create(header.rows, header.cols, header.type);
+        if (frame.image.isContinuous()) {
+            in_.read(reinterpret_cast<char *>(frame.image.data),
+                frame.image.total() * frame.image.elemSize());
+        } else {
+            const size_t row_bytes = frame.image.cols * frame.image.elemSize();
+            for (int i = 0; i < frame.image.rows; i++) {
+                in_.read(reinterpret_cast<char *>(frame.image.ptr(i)),
+                    row_bytes);
+            }
+        }
+
+        if (!in_) {
+            std::cerr << "Failed to read frame " << header.id
+                << " from the record file\n";
+            return false;
+        }
+
+        frame.id = header.id;
+        frame.capture_ns = header.capture_ns;
+        frame.position_ms = header.position_ms;
+
+        if (!started_) {
+            first_capture_ns_ = header.capture_ns;
+            start_ns_ = monotonic_ns();
+            started_ = true;
+        }
+
+        // Wait until the frame is due, relative to the first frame.
+        if (realtime_) {
+            const int64_t due_ns = start_ns_ +
+                (header.capture_ns - first_capture_ns_);
+            const int64_t wait_ns = due_ns - monotonic_ns();
+            if (wait_ns > 0) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(wait_ns));
+            }
+        }
+
+        frame.arrival_ns = monotonic_ns();
+        return true;
+    }
+
+private:
+    std::ifstream in_;
+    bool realtime_;
+    int64_t first_capture_ns_;
+    int64_t start_ns_;
+    bool started_;
+    uint64_t file_size_;
+};
+
+}  // namespace fdcl
+
+#endif
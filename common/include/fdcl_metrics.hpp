@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_METRICS_HPP__
+#define __FDCL_METRICS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace fdcl {
+
+/**
+ * Metrics in the Prometheus text exposition format.
+ *
+ * Updating a metric is a relaxed atomic operation, so it is safe to do from
+ * the hot path of a detection loop while an exporter thread renders the
+ * registry. All the metrics must be added to the registry before an exporter
+ * is started.
+ */
+inline std::string format_metric_value(const double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.10g", value);
+    return text;
+}
+
+
+class Metric {
+public:
+    Metric(const std::string &name, const std::string &help,
+        const std::string &labels) : name_(name), help_(help),
+        labels_(labels) {}
+
+    virtual ~Metric() {}
+
+    const std::string &name() const { return name_; }
+    const std::string &help() const { return help_; }
+
+    virtual const char *type() const = 0;
+    virtual void render(std::ostream &out) const = 0;
+
+protected:
+    std::string series(const std::string &suffix = "",
+        const std::string &extra_label = "") const {
+
+        std::string labels = labels_;
+        if (!extra_label.empty()) {
+            labels += (labels.empty() ? "" : ",") + extra_label;
+        }
+
+        return name_ + suffix + (labels.empty() ? "" : "{" + labels + "}");
+    }
+
+    std::string name_;
+    std::string help_;
+    std::string labels_;
+};
+
+
+class Counter : public Metric {
+public:
+    Counter(const std::string &name, const std::string &help,
+        const std::string &labels) : Metric(name, help, labels), value_(0) {}
+
+    void inc(const uint64_t n = 1) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+    const char *type() const { return "counter"; }
+
+    void render(std::ostream &out) const {
+        out << series() << " " << value() << "\n";
+    }
+
+private:
+    std::atomic<uint64_t> value_;
+};
+
+
+class Gauge : public Metric {
+public:
+    Gauge(const std::string &name, const std::string &help,
+        const std::string &labels) : Metric(name, help, labels), value_(0.0) {}
+
+    void set(const double value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    double value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+    const char *type() const { return "gauge"; }
+
+    void render(std::ostream &out) const {
+        out << series() << " " << format_metric_value(value()) << "\n";
+    }
+
+private:
+    std::atomic<double> value_;
+};
+
+
+/**
+ * Counters for each id of a dictionary, rendered with an id label. Only the
+ * ids which were counted at least once are rendered.
+ */
+class IdCounter : public Metric {
+public:
+    IdCounter(const std::string &name, const std::string &help,
+        const std::string &labels, const int n_ids) :
+        Metric(name, help, labels), values_(new std::atomic<uint64_t>[n_ids]),
+        n_ids_(n_ids) {
+
+        for (int i = 0; i < n_ids_; i++) {
+            values_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void inc(const int id, const uint64_t n = 1) {
+        if (id >= 0 && id < n_ids_) {
+            values_[id].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    const char *type() const { return "counter"; }
+
+    void render(std::ostream &out) const {
+        for (int i = 0; i < n_ids_; i++) {
+            const uint64_t value = values_[i].load(std::memory_order_relaxed);
+            if (value > 0) {
+                out << series("", "id=\"" + std::to_string(i) + "\"") << " "
+                    << value << "\n";
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> values_;
+    int n_ids_;
+};
+
+
+class Histogram : public Metric {
+public:
+    Histogram(const std::string &name, const std::string &help,
+        const std::string &labels, const std::vector<double> &bounds) :
+        Metric(name, help, labels), bounds_(bounds),
+        buckets_(new std::atomic<uint64_t>[bounds.size() + 1]), sum_(0.0) {
+
+        for (size_t i = 0; i <= bounds_.size(); i++) {
+            buckets_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void observe(const double value) {
+        size_t i = 0;
+        while (i < bounds_.size() && value > bounds_[i]) {
+            i++;
+        }
+        buckets_[i].fetch_add(1, std::memory_order_relaxed);
+
+        double sum = sum_.load(std::memory_order_relaxed);
+        while (!sum_.compare_exchange_weak(sum, sum + value,
+            std::memory_order_relaxed)) {
+        }
+    }
+
+    const char *type() const { return "histogram"; }
+
+    void render(std::ostream &out) const {
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i <= bounds_.size(); i++) {
+            cumulative += buckets_[i].load(std::memory_order_relaxed);
+            const std::string le = i < bounds_.size() ?
+                format_metric_value(bounds_[i]) : "+Inf";
+            out << series("_bucket", "le=\"" + le + "\"") << " "
+                << cumulative << "\n";
+        }
+
+        out << series("_sum") << " "
+            << format_metric_value(sum_.load(std::memory_order_relaxed))
+            << "\n";
+        out << series("_count") << " " << cumulative << "\n";
+    }
+
+private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+    std::atomic<double> sum_;
+};
+
+
+/**
+ * Latency buckets in seconds, from 0.5 ms to 1 s.
+ */
+inline std::vector<double> latency_buckets() {
+    const double bounds[] = {0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05,
+        0.1, 0.2, 0.5, 1.0};
+    return std::vector<double>(bounds,
+        bounds + sizeof(bounds) / sizeof(bounds[0]));
+}
+
+
+class MetricsRegistry {
+public:
+    Counter &counter(const std::string &name, const std::string &help,
+        const std::string &labels = "") {
+        return add(new Counter(name, help, labels));
+    }
+
+    Gauge &gauge(const std::string &name, const std::string &help,
+        const std::string &labels = "") {
+        return add(new Gauge(name, help, labels));
+    }
+
+    IdCounter &id_counter(const std::string &name, const std::string &help,
+        const int n_ids, const std::string &labels = "") {
+        return add(new IdCounter(name, help, labels, n_ids));
+    }
+
+    Histogram &histogram(const std::string &name, const std::string &help,
+        const std::vector<double> &bounds, const std::string &labels = "") {
+        return add(new Histogram(name, help, labels, bounds));
+    }
+
+
+    /**
+     * Metrics with the same name, but different labels, must be added one
+     * after the other so that they share their HELP and TYPE lines.
+     */
+    std::string render() const {
+        std::ostringstream out;
+        for (size_t i = 0; i < metrics_.size(); i++) {
+            const Metric &metric = *metrics_[i];
+            if (i == 0 || metrics_[i - 1]->name() != metric.name()) {
+                out << "# HELP " << metric.name() << " " << metric.help()
+                    << "\n# TYPE " << metric.name() << " " << metric.type()
+                    << "\n";
+            }
+            metric.render(out);
+        }
+        return out.str();
+    }
+
+private:
+    template <typename T>
+    T &add(T *metric) {
+        metrics_.push_back(std::unique_ptr<Metric>(metric));
+        return *metric;
+    }
+
+    std::vector<std::unique_ptr<Metric> > metrics_;
+};
+
+
+/**
+ * Serves the registry at http://127.0.0.1:<port>/metrics from its own
+ * thread. Only the loopback interface is bound.
+ */
+class HttpExporter {
+public:
+    HttpExporter() : registry_(nullptr), fd_(-1), port_(0), running_(false) {}
+
+    ~HttpExporter() {
+        stop();
+    }
+
+
+    /**
+     * Port 0 picks a free port, which port() returns once started.
+     */
+    bool start(const MetricsRegistry &registry, const int port) {
+        stop();
+
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd_ < 0) {
+            std::cerr << "Failed to create the metrics socket\n";
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(fd_, reinterpret_cast<sockaddr *>(&address),
+            sizeof(address)) != 0 || listen(fd_, 8) != 0) {
+            std::cerr << "Failed to serve metrics on port " << port << "\n";
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+
+        socklen_t length = sizeof(address);
+        getsockname(fd_, reinterpret_cast<sockaddr *>(&address), &length);
+        port_ = ntohs(address.sin_port);
+
+        registry_ = &registry;
+        running_.store(true);
+        thread_ = std::thread(&HttpExporter::serve, this);
+        return true;
+    }
+
+
+    void stop() {
+        running_.store(false);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        port_ = 0;
+    }
+
+
+    int port() const {
+        return port_;
+    }
+
+private:
+    void serve() {
+        while (running_.load()) {
+            pollfd listener;
+            listener.fd = fd_;
+            listener.events = POLLIN;
+            listener.revents = 0;
+
+            if (poll(&listener, 1, 200) <= 0) {
+                continue;
+            }
+
+            int client = accept(fd_, nullptr, nullptr);
+            if (client < 0) {
+                continue;
+            }
+
+            respond(client);
+            ::close(client);
+        }
+    }
+
+
+    void respond(const int client) {
+        timeval timeout;
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(timeout));
+
+        char request[2048];
+        const ssize_t n = recv(client, request, sizeof(request) - 1, 0);
+        if (n <= 0) {
+            return;
+        }
+        request[n] = '\0';
+
+        std::string status = "200 OK";
+        std::string body;
+        if (std::strncmp(request, "GET /metrics", 12) == 0 ||
+            std::strncmp(request, "GET / ", 6) == 0) {
+            body = registry_->render();
+        } else {
+            status = "404 Not Found";
+            body = "Not found, metrics are served at /metrics\n";
+        }
+
+        const std::string response = "HTTP/1.1 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+
+        size_t sent = 0;
+        while (sent < response.size()) {
+            const ssize_t k = send(client, response.data() + sent,
+                response.size() - sent, MSG_NOSIGNAL);
+            if (k <= 0) {
+                return;
+            }
+            sent += k;
+        }
+    }
+
+
+    const MetricsRegistry *registry_;
+    int fd_;
+    int port_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+
+/**
+ * Periodically writes the registry to a file, for the textfile collector of
+ * the Prometheus node exporter. The file is replaced atomically, so it is
+ * never read half written.
+ */
+class TextfileExporter {
+public:
+    TextfileExporter() : registry_(nullptr), running_(false) {}
+
+    ~TextfileExporter() {
+        stop();
+    }
+
+
+    bool start(const MetricsRegistry &registry, const std::string &path,
+        const int interval_ms = 1000) {
+        stop();
+
+        registry_ = &registry;
+        path_ = path;
+        interval_ms_ = interval_ms;
+
+        if (!write()) {
+            std::cerr << "Failed to write metrics to " << path << "\n";
+            return false;
+        }
+
+        running_.store(true);
+        thread_ = std::thread(&TextfileExporter::run, this);
+        return true;
+    }
+
+
+    void stop() {
+        running_.store(false);
+        if (thread_.joinable()) {
+            thread_.join();
+            write();
+        }
+    }
+
+private:
+    void run() {
+        const std::chrono::milliseconds step(50);
+        std::chrono::milliseconds waited(0);
+
+        while (running_.load()) {
+            std::this_thread::sleep_for(step);
+            waited += step;
+
+            if (waited.count() >= interval_ms_) {
+                write();
+                waited = std::chrono::milliseconds(0);
+            }
+        }
+    }
+
+
+    bool write() {
+        const std::string tmp_path = path_ + ".tmp";
+        {
+            std::ofstream out(tmp_path.c_str(), std::ios::trunc);
+            if (!out) {
+                return false;
+            }
+            out << registry_->render();
+        }
+
+        return std::rename(tmp_path.c_str(), path_.c_str()) == 0;
+    }
+
+
+    const MetricsRegistry *registry_;
+    std::string path_;
+    int interval_ms_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+}  // namespace fdcl
+
+#endif
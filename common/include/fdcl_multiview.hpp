@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_MULTIVIEW_HPP__
+#define __FDCL_MULTIVIEW_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fdcl {
+
+/**
+ * A calibrated camera of a rig. R and t take a point from the frame of the
+ * reference camera (camera 0) to the frame of this camera, x = R x_0 + t,
+ * which is the convention of cv::stereoCalibrate.
+ */
+struct CameraView {
+    CameraView() : R(cv::Matx33d::eye()), t(0, 0, 0) {}
+
+    cv::Mat camera_matrix;
+    cv::Mat dist_coeffs;
+    cv::Matx33d R;
+    cv::Vec3d t;
+    cv::Size image_size;
+};
+
+
+/**
+ * Splits a comma separated list, e.g. the video sources of a rig.
+ */
+inline std::vector<std::string> split_list(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+
+/**
+ * Rig files have n_cameras, and a camera_<i> node for each camera with its
+ * intrinsics (as written by camera_calibration) and its extrinsics R and T.
+ */
+inline bool write_rig(const std::string &path,
+    const std::vector<CameraView> &views,
+    const std::vector<double> &rms_errors) {
+
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        return false;
+    }
+
+    fs << "n_cameras" << static_cast<int>(views.size());
+    for (size_t i = 0; i < views.size(); i++) {
+        fs << "camera_" + std::to_string(i) << "{"
+            << "image_width" << views[i].image_size.width
+            << "image_height" << views[i].image_size.height
+            << "camera_matrix" << views[i].camera_matrix
+            << "distortion_coefficients" << views[i].dist_coeffs
+            << "R" << cv::Mat(views[i].R)
+            << "T" << cv::Mat(views[i].t)
+            << "rms_error" << (i < rms_errors.size() ? rms_errors[i] : 0.0)
+            << "}";
+    }
+
+    return true;
+}
+
+
+inline bool read_rig(const std::string &path,
+    std::vector<CameraView> &views) {
+
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to open the rig file " << path << "\n";
+        return false;
+    }
+
+    const int n_cameras = static_cast<int>(fs["n_cameras"]);
+    if (n_cameras < 1) {
+        std::cerr << "The rig file " << path << " has no camera\n";
+        return false;
+    }
+
+    views.resize(n_cameras);
+    for (int i = 0; i < n_cameras; i++) {
+        const cv::FileNode node = fs["camera_" + std::to_string(i)];
+        if (node.empty()) {
+            std::cerr << "The rig file " << path << " is missing camera "
+                << i << "\n";
+            return false;
+        }
+
+        cv::Mat R, T;
+        node["camera_matrix"] >> views[i].camera_matrix;
+        node["distortion_coefficients"] >> views[i].dist_coeffs;
+        node["R"] >> R;
+        node["T"] >> T;
+        views[i].image_size = cv::Size(static_cast<int>(node["image_width"]),
+            static_cast<int>(node["image_height"]));
+
+        if (views[i].camera_matrix.empty() || R.total() != 9 ||
+            T.total() != 3) {
+            std::cerr << "Invalid camera " << i << " in the rig file " << path
+                << "\n";
+            return false;
+        }
+
+        R.convertTo(R, CV_64F);
+        T.convertTo(T, CV_64F);
+        views[i].R = cv::Matx33d(R.ptr<double>());
+        views[i].t = cv::Vec3d(T.ptr<double>());
+    }
+
+    return true;
+}
+
+
+/**
+ * Pose of a marker in the frame of the reference camera, fused from all the
+ * views which detected it.
+ */
+struct MultiViewPose {
+    int id;
+    int n_views;
+    cv::Vec3d rvec;
+    cv::Vec3d tvec;
+
+    // RMS distance in meter between the triangulated corners and the fitted
+    // marker square, 0 for markers seen by a single view
+    double rms_m;
+};
+
+
+/**
+ * Triangulates a point from its normalized (undistorted) image coordinates
+ * in any number of views, with the linear DLT method.
+ */
+inline cv::Vec3d triangulate(const std::vector<CameraView> &views,
+    const std::vector<int> &view_ids,
+    const std::vector<cv::Point2d> &points) {
+
+    cv::Mat A(2 * static_cast<int>(view_ids.size()), 4, CV_64F);
+    for (size_t k = 0; k < view_ids.size(); k++) {
+        const CameraView &view = views[view_ids[k]];
+        const cv::Matx14d row0(view.R(0, 0), view.R(0, 1), view.R(0, 2),
+            view.t(0));
+        const cv::Matx14d row1(view.R(1, 0), view.R(1, 1), view.R(1, 2),
+            view.t(1));
+        const cv::Matx14d row2(view.R(2, 0), view.R(2, 1), view.R(2, 2),
+            view.t(2));
+
+        cv::Mat(points[k].x * row2 - row0).copyTo(A.row(2 * k));
+        cv::Mat(points[k].y * row2 - row1).copyTo(A.row(2 * k + 1));
+    }
+
+    cv::Mat w, u, vt;
+    cv::SVD::compute(A, w, u, vt, cv::SVD::MODIFY_A);
+    const double *X = vt.ptr<double>(3);
+    return cv::Vec3d(X[0] / X[3], X[1] / X[3], X[2] / X[3]);
+}
+
+
+/**
+ * Rigid transform (Kabsch) which best maps the model points onto the
+ * measured points, measured = R model + t. Returns the RMS residual.
+ */
+inline double fit_rigid_transform(const std::vector<cv::Vec3d> &model,
+    const std::vector<cv::Vec3d> &measured, cv::Matx33d &R, cv::Vec3d &t) {
+
+    const double n = static_cast<double>(model.size());
+    cv::Vec3d model_center(0, 0, 0), measured_center(0, 0, 0);
+    for (size_t i = 0; i < model.size(); i++) {
+        model_center += model[i] / n;
+        measured_center += measured[i] / n;
+    }
+
+    cv::Matx33d H = cv::Matx33d::zeros();
+    for (size_t i = 0; i < model.size(); i++) {
+        H += (model[i] - model_center) *
+            (measured[i] - measured_center).t();
+    }
+
+    cv::Matx33d U, Vt;
+    cv::Matx31d S;
+    cv::SVD::compute(H, S, U, Vt);
+
+    // Flip the last axis if needed, so that R is a rotation and not a
+    // reflection.
+    cv::Matx33d D = cv::Matx33d::eye();
+    D(2, 2) = cv::determinant(Vt.t() * U.t()) < 0 ? -1.0 : 1.0;
+    R = Vt.t() * D * U.t();
+    t = measured_center - R * model_center;
+
+    double sum = 0.0;
+    for (size_t i = 0; i < model.size(); i++) {
+        const cv::Vec3d error = R * model[i] + t - measured[i];
+        sum += error.dot(error);
+    }
+    return std::sqrt(sum / n);
+}
+
+
+/**
+ * Marker poses from a rig of calibrated cameras.
+ *
+ * The markers are detected in all the views in parallel and associated by
+ * id. The corners of the markers seen by two views or more are
+ * triangulated, and the marker square is fitted to them, which keeps the
+ * depth error small at range, unlike single view PnP. The markers seen by a
+ * single view fall back to PnP in that view.
+ */
+class MultiViewEstimator {
+public:
+    MultiViewEstimator(const std::vector<CameraView> &views,
+        const cv::Ptr<cv::aruco::Dictionary> &dictionary,
+        const cv::Ptr<cv::aruco::DetectorParameters> &params,
+        const float marker_length) : views_(views), dictionary_(dictionary),
+        params_(params), corners_(views.size()), ids_(views.size()) {
+
+        // Same corner order as cv::aruco::estimatePoseSingleMarkers
+        const double half = marker_length / 2.0;
+        model_.push_back(cv::Vec3d(-half, half, 0));
+        model_.push_back(cv::Vec3d(half, half, 0));
+        model_.push_back(cv::Vec3d(half, -half, 0));
+        model_.push_back(cv::Vec3d(-half, -half, 0));
+    }
+
+
+    void set_parameters(
+        const cv::Ptr<cv::aruco::DetectorParameters> &params) {
+        params_ = params;
+    }
+
+
+    /**
+     * grays has one image for each view, in the order of the rig.
+     */
+    void estimate(const std::vector<cv::Mat> &grays,
+        std::vector<MultiViewPose> &poses) {
+
+        cv::parallel_for_(cv::Range(0, static_cast<int>(views_.size())),
+            [&](const cv::Range &range) {
+                for (int i = range.start; i < range.end; i++) {
+                    cv::aruco::detectMarkers(grays[i], dictionary_,
+                        corners_[i], ids_[i], params_);
+                }
+            });
+
+        // Associate the markers by id, with the normalized coordinates of
+        // their corners in each view.
+        std::map<int, std::vector<std::pair<int, int> > > observations;
+        for (size_t i = 0; i < views_.size(); i++) {
+            for (size_t j = 0; j < ids_[i].size(); j++) {
+                observations[ids_[i][j]].push_back(
+                    std::make_pair(static_cast<int>(i), static_cast<int>(j)));
+            }
+        }
+
+        poses.clear();
+        std::map<int, std::vector<std::pair<int, int> > >::const_iterator it;
+        for (it = observations.begin(); it != observations.end(); ++it) {
+            MultiViewPose pose;
+            pose.id = it->first;
+            pose.n_views = static_cast<int>(it->second.size());
+            pose.rms_m = 0.0;
+
+            const bool valid = pose.n_views > 1 ?
+                triangulate_pose(it->second, pose) :
+                single_view_pose(it->second[0], pose);
+            if (valid) {
+                poses.push_back(pose);
+            }
+        }
+    }
+
+
+    const std::vector<std::vector<std::vector<cv::Point2f> > > &corners()
+        const {
+        return corners_;
+    }
+
+    const std::vector<std::vector<int> > &ids() const {
+        return ids_;
+    }
+
+private:
+    bool triangulate_pose(const std::vector<std::pair<int, int> > &seen,
+        MultiViewPose &pose) {
+
+        std::vector<int> view_ids(seen.size());
+        std::vector<std::vector<cv::Point2f> > normalized(seen.size());
+        for (size_t k = 0; k < seen.size(); k++) {
+            const CameraView &view = views_[seen[k].first];
+            view_ids[k] = seen[k].first;
+            cv::undistortPoints(corners_[seen[k].first][seen[k].second],
+                normalized[k], view.camera_matrix, view.dist_coeffs);
+        }
+
+        std::vector<cv::Vec3d> triangulated(4);
+        std::vector<cv::Point2d> points(seen.size());
+        for (int c = 0; c < 4; c++) {
+            for (size_t k = 0; k < seen.size(); k++) {
+                points[k] = cv::Point2d(normalized[k][c]);
+            }
+            triangulated[c] = triangulate(views_, view_ids, points);
+        }
+
+        cv::Matx33d R;
+        pose.rms_m = fit_rigid_transform(model_, triangulated, R, pose.tvec);
+        cv::Rodrigues(R, pose.rvec);
+
+        return cv::checkRange(pose.tvec) && pose.tvec(2) > 0;
+    }
+
+
+    bool single_view_pose(const std::pair<int, int> &seen,
+        MultiViewPose &pose) {
+
+        const CameraView &view = views_[seen.first];
+        std::vector<cv::Point3d> model(model_.begin(), model_.end());
+        cv::Vec3d rvec, tvec;
+        if (!cv::solvePnP(model, corners_[seen.first][seen.second],
+            view.camera_matrix, view.dist_coeffs, rvec, tvec, false,
+            cv::SOLVEPNP_IPPE_SQUARE)) {
+            return false;
+        }
+
+        // Back to the frame of the reference camera, x_0 = R^T (x - t)
+        cv::Matx33d R;
+        cv::Rodrigues(rvec, R);
+        const cv::Matx33d R0 = view.R.t() * R;
+        pose.tvec = view.R.t() * (tvec - view.t);
+        cv::Rodrigues(R0, pose.rvec);
+
+        return true;
+    }
+
+
+    std::vector<CameraView> views_;
+    cv::Ptr<cv::aruco::Dictionary> dictionary_;
+    cv::Ptr<cv::aruco::DetectorParameters> params_;
+    std::vector<cv::Vec3d> model_;
+
+    std::vector<std::vector<std::vector<cv::Point2f> > > corners_;
+    std::vector<std::vector<int> > ids_;
+};
+
+}  // namespace fdcl
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_POSE_HPP__
+#define __FDCL_POSE_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <vector>
+
+namespace fdcl {
+
+/**
+ * Scalar of the stored marker poses. FDCL_FLOAT_POSES keeps the poses, and
+ * everything downstream of them (drawing, shared memory, metrics), in
+ * single precision. It does not make the solver faster: the pose solver
+ * always runs in double precision.
+ */
+#ifdef FDCL_FLOAT_POSES
+typedef float pose_t;
+#else
+typedef double pose_t;
+#endif
+
+typedef cv::Vec<pose_t, 3> PoseVec;
+typedef cv::Matx<pose_t, 3, 3> PoseMat;
+
+
+/**
+ * Pose of each detected marker, like cv::aruco::estimatePoseSingleMarkers,
+ * in the precision of pose_t.
+ *
+ * The markers are solved in parallel by estimatePoseSingleMarkers, which
+ * works in double precision. With FDCL_FLOAT_POSES, its output is converted
+ * once to single precision.
+ */
+class MarkerPoseEstimator {
+public:
+    MarkerPoseEstimator(const float marker_length,
+        const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs) :
+        marker_length_(marker_length) {
+
+        camera_matrix.convertTo(camera_matrix_, CV_64F);
+        dist_coeffs.convertTo(dist_coeffs_, CV_64F);
+    }
+
+
+    void estimate(const std::vector<std::vector<cv::Point2f> > &corners,
+        std::vector<PoseVec> &rvecs, std::vector<PoseVec> &tvecs) {
+
+#ifdef FDCL_FLOAT_POSES
+        cv::aruco::estimatePoseSingleMarkers(corners, marker_length_,
+            camera_matrix_, dist_coeffs_, rvecs_, tvecs_);
+
+        rvecs.resize(rvecs_.size());
+        tvecs.resize(tvecs_.size());
+        for (size_t i = 0; i < rvecs_.size(); i++) {
+            rvecs[i] = PoseVec(rvecs_[i]);
+            tvecs[i] = PoseVec(tvecs_[i]);
+        }
+#else
+        cv::aruco::estimatePoseSingleMarkers(corners, marker_length_,
+            camera_matrix_, dist_coeffs_, rvecs, tvecs);
+#endif
+    }
+
+
+    const cv::Mat &camera_matrix() const { return camera_matrix_; }
+    const cv::Mat &dist_coeffs() const { return dist_coeffs_; }
+
+private:
+    float marker_length_;
+    cv::Mat camera_matrix_;
+    cv::Mat dist_coeffs_;
+#ifdef FDCL_FLOAT_POSES
+    std::vector<cv::Vec3d> rvecs_, tvecs_;
+#endif
+};
+
+}  // namespace fdcl
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_PREPROCESS_HPP__
+#define __FDCL_PREPROCESS_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/ocl.hpp>
+#include <iostream>
+
+namespace fdcl {
+
+/**
+ * Converts the captured frames to the grayscale images used for detection,
+ * optionally removing the lens distortion.
+ *
+ * With OpenCL enabled, the frames are uploaded to cv::UMat buffers so that the
+ * color conversion and the remap run through OpenCV's transparent API on
+ * whatever OpenCL device is available, including CPU runtimes such as PoCL.
+ * If no OpenCL device is available, the same stages run on cv::Mat.
+ */
+class FramePreprocessor {
+public:
+    FramePreprocessor() : use_ocl_(false), undistort_(false) {}
+
+
+    /**
+     * Requests the OpenCL path. Returns whether it is actually active.
+     */
+    bool set_opencl(const bool enable) {
+        use_ocl_ = false;
+
+        if (enable) {
+            if (cv::ocl::haveOpenCL()) {
+                cv::ocl::setUseOpenCL(true);
+                use_ocl_ = cv::ocl::useOpenCL();
+            }
+
+            if (use_ocl_) {
+                std::cout << "Using OpenCL device "
+                    << cv::ocl::Device::getDefault().name() << "\n";
+            } else {
+                std::cerr << "OpenCL is not available, falling back to "
+                    "cv::Mat\n";
+            }
+        }
+
+        return use_ocl_;
+    }
+
+
+    /**
+     * Removes the lens distortion from the frames before detection. The
+     * detected corners then follow the pinhole model of camera_matrix, with
+     * zero distortion.
+     */
+    void set_undistort(const cv::Mat &camera_matrix,
+        const cv::Mat &dist_coeffs) {
+
+        camera_matrix.copyTo(camera_matrix_);
+        dist_coeffs.copyTo(dist_coeffs_);
+        map_size_ = cv::Size();
+        undistort_ = true;
+    }
+
+
+    bool opencl() const {
+        return use_ocl_;
+    }
+
+
+    void process(const cv::Mat &frame, cv::Mat &gray) {
+        if (undistort_ && frame.size() != map_size_) {
+            init_maps(frame.size());
+        }
+
+        if (use_ocl_) {
+            frame.copyTo(u_frame_);
+            to_gray(u_frame_, u_gray_);
+
+            if (undistort_) {
+                cv::remap(u_gray_, u_rectified_, u_map_x_, u_map_y_,
+                    cv::INTER_LINEAR);
+                u_rectified_.copyTo(gray);
+            } else {
+                u_gray_.copyTo(gray);
+            }
+            return;
+        }
+
+        if (undistort_) {
+            to_gray(frame, gray_);
+            cv::remap(gray_, gray, map_x_, map_y_, cv::INTER_LINEAR);
+        } else {
+            to_gray(frame, gray);
+        }
+    }
+
+    /**
+     * Removes the lens distortion from a color frame with the same maps as
+     * process(), e.g. to draw on the image the detection ran on. Copies the
+     * frame if undistortion is off.
+     */
+    void undistort(const cv::Mat &frame, cv::Mat &out) {
+        if (!undistort_) {
+            frame.copyTo(out);
+            return;
+        }
+
+        if (frame.size() != map_size_) {
+            init_maps(frame.size());
+        }
+        cv::remap(frame, out, map_x_, map_y_, cv::INTER_LINEAR);
+    }
+
+private:
+    template <typename T>
+    static void to_gray(const T &src, T &dst) {
+        if (src.channels() == 3) {
+            cv::cvtColor(src, dst, cv::COLOR_BGR2GRAY);
+        } else if (src.channels() == 4) {
+            cv::cvtColor(src, dst, cv::COLOR_BGRA2GRAY);
+        } else {
+            src.copyTo(dst);
+        }
+    }
+
+
+    void init_maps(const cv::Size &size) {
+        cv::initUndistortRectifyMap(camera_matrix_, dist_coeffs_, cv::Mat(),
+            camera_matrix_, size, CV_32FC1, map_x_, map_y_);
+        map_x_.copyTo(u_map_x_);
+        map_y_.copyTo(u_map_y_);
+        map_size_ = size;
+    }
+
+
+    bool use_ocl_;
+    bool undistort_;
+
+    cv::Mat camera_matrix_, dist_coeffs_;
+    cv::Size map_size_;
+
+    cv::Mat gray_, map_x_, map_y_;
+    cv::UMat u_frame_, u_gray_, u_rectified_, u_map_x_, u_map_y_;
+};
+
+}  // namespace fdcl
+
+#endif
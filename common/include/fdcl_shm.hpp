@@ -0,0 +1,495 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __FDCL_SHM_HPP__
+#define __FDCL_SHM_HPP__
+
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fdcl_frame.hpp"
+
+namespace fdcl {
+
+/**
+ * Shared memory ring buffer of frames and marker poses.
+ *
+ * A single writer publishes into a ring of slots, each guarded by a seqlock:
+ * the sequence of a slot is odd while it is being written and even once it
+ * is published. Readers never write to the shared memory, so any number of
+ * them can attach or detach at any time and the writer never waits on them.
+ * A reader copies what it needs out of a slot and retries if the sequence
+ * changed in the meantime.
+ *
+ * The layout is a ShmHeader followed by n_slots slots of slot_stride bytes.
+ * Each slot is a ShmSlot followed by the raw frame buffer.
+ */
+const uint32_t shm_magic = 0x4644434c;
+const uint32_t shm_version = 3;
+const int shm_max_poses = 64;
+const int shm_min_slots = 2;
+const int shm_max_slots = 1024;
+
+// Largest shared memory object, so that its size also fits in off_t
+const size_t shm_max_size =
+    static_cast<size_t>(std::numeric_limits<off_t>::max()) / 2;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+    "The shared memory ring buffer needs lock-free atomics");
+
+
+/**
+ * confidence is the fdcl::MarkerScore confidence of the marker, or negative
+ * if the marker was not scored.
+ */
+struct PoseRecord {
+    int32_t id;
+    float confidence;
+    double rvec[3];
+    double tvec[3];
+};
+
+
+struct ShmSlot {
+    std::atomic<uint32_t> seq;
+    int32_t n_poses;
+    uint64_t frame_id;
+    int64_t capture_ns;
+    double position_ms;
+    int64_t publish_ns;
+
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t reserved;
+    uint64_t step;
+
+    PoseRecord poses[shm_max_poses];
+};
+
+
+struct ShmHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t reserved;
+    uint64_t slot_stride;
+    uint64_t frame_capacity;
+
+    // Number of published slots, the latest one is (write_index - 1).
+    std::atomic<uint64_t> write_index;
+};
+
+
+inline size_t shm_align(const size_t size) {
+    return (size + 63) & ~static_cast<size_t>(63);
+}
+
+
+/**
+ * A copy of one published slot.
+ */
+struct ShmSample {
+    uint64_t frame_id;
+    int64_t capture_ns;
+    double position_ms;
+    int64_t publish_ns;
+    std::vector<PoseRecord> poses;
+};
+
+
+class ShmWriter {
+public:
+    ShmWriter() : header_(nullptr), size_(0), slot_(nullptr) {}
+
+    ~ShmWriter() {
+        close();
+    }
+
+
+    /**
+     * Creates the shared memory object, replacing a stale one with the same
+     * name. frame_capacity is the size of the largest frame in bytes.
+     */
+    bool create(const std::string &name, const int n_slots,
+        const size_t frame_capacity) {
+
+        close();
+
+        if (n_slots < shm_min_slots || n_slots > shm_max_slots) {
+            std::cerr << "Shared memory needs between " << shm_min_slots
+                << " and " << shm_max_slots << " slots, got " << n_slots
+                << "\n";
+            return false;
+        }
+
+        // Bounding the frame first keeps the sizes below from overflowing.
+        const size_t n = static_cast<size_t>(n_slots);
+        if (frame_capacity > shm_max_size / (2 * n)) {
+            std::cerr << "Shared memory frames of " << frame_capacity
+                << " bytes are too large for " << n_slots << " slots\n";
+            return false;
+        }
+
+        const size_t slot_stride = shm_align(sizeof(ShmSlot)) +
+            shm_align(frame_capacity);
+        const size_t size = shm_align(sizeof(ShmHeader)) + n * slot_stride;
+
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            std::cerr << "Failed to create shared memory " << name << "\n";
+            return false;
+        }
+
+        if (ftruncate(fd, size) != 0) {
+            std::cerr << "Failed to size shared memory " << name << "\n";
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "Failed to map shared memory " << name << "\n";
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        name_ = name;
+        size_ = size;
+        header_ = static_cast<ShmHeader *>(addr);
+
+        // The object is zero filled by ftruncate, so every sequence starts
+        // even and readers only accept the header once the magic is set.
+        header_->version = shm_version;
+        header_->n_slots = n_slots;
+        header_->slot_stride = slot_stride;
+        header_->frame_capacity = shm_align(frame_capacity);
+        header_->write_index.store(0, std::memory_order_relaxed);
+        header_->magic.store(shm_magic, std::memory_order_release);
+
+        return true;
+    }
+
+
+    void close() {
+        if (!header_) {
+            return;
+        }
+
+        header_->magic.store(0, std::memory_order_release);
+        munmap(header_, size_);
+        shm_unlink(name_.c_str());
+
+        header_ = nullptr;
+        slot_ = nullptr;
+        size_ = 0;
+    }
+
+
+    bool is_open() const {
+        return header_ != nullptr;
+    }
+
+
+    /**
+     * Starts writing the next slot and returns a cv::Mat on its frame buffer.
+     * Capturing straight into this Mat publishes the frame without a copy.
+     * The returned Mat is empty if the frame does not fit in the slot.
+     */
+    cv::Mat acquire(const cv::Size &size, const int type) {
+        if (!slot_) {
+            const uint64_t index = header_->write_index.load(
+                std::memory_order_relaxed);
+            slot_ = slot_at(index % header_->n_slots);
+
+            const uint32_t seq = slot_->seq.load(std::memory_order_relaxed);
+            slot_->seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        if (static_cast<uint64_t>(size.area()) * CV_ELEM_SIZE(type) >
+            header_->frame_capacity) {
+            return cv::Mat();
+        }
+
+        return cv::Mat(size, type, frame_at(slot_));
+    }
+
+
+    /**
+     * Publishes the slot started by acquire() with the frame, its timestamps
+     * and the poses. If the frame was not captured into the slot, it is
+     * copied. confidences can be empty if the markers were not scored.
+     */
+    template <typename T>
+    void publish(const Frame &captured, const std::vector<int> &ids,
+        const std::vector<cv::Vec<T, 3> > &rvecs,
+        const std::vector<cv::Vec<T, 3> > &tvecs,
+        const std::vector<float> &confidences = std::vector<float>()) {
+
+        const cv::Mat &frame = captured.image;
+
+        if (!slot_) {
+            acquire(frame.size(), frame.type());
+        }
+
+        uint8_t *buffer = frame_at(slot_);
+        const size_t frame_bytes = frame.total() * frame.elemSize();
+
+        if (!frame.empty() && frame_bytes <= header_->frame_capacity) {
+            if (frame.data != buffer) {
+                cv::Mat slot_frame(frame.size(), frame.type(), buffer);
+                frame.copyTo(slot_frame);
+            }
+
+            slot_->rows = frame.rows;
+            slot_->cols = frame.cols;
+            slot_->type = frame.type();
+            slot_->step = frame.cols * frame.elemSize();
+        } else {
+            slot_->rows = 0;
+            slot_->cols = 0;
+            slot_->type = 0;
+            slot_->step = 0;
+        }
+
+        const size_t n_poses = std::min(ids.size(),
+            static_cast<size_t>(shm_max_poses));
+        for (size_t i = 0; i < n_poses; i++) {
+            PoseRecord &pose = slot_->poses[i];
+            pose.id = ids[i];
+            pose.confidence = i < confidences.size() ? confidences[i] : -1.0f;
+            for (int j = 0; j < 3; j++) {
+                pose.rvec[j] = rvecs[i](j);
+                pose.tvec[j] = tvecs[i](j);
+            }
+        }
+
+        slot_->n_poses = static_cast<int32_t>(n_poses);
+        slot_->frame_id = captured.id;
+        slot_->capture_ns = captured.capture_ns;
+        slot_->position_ms = captured.position_ms;
+        slot_->publish_ns = monotonic_ns();
+
+        const uint32_t seq = slot_->seq.load(std::memory_order_relaxed);
+        slot_->seq.store(seq + 1, std::memory_order_release);
+        header_->write_index.fetch_add(1, std::memory_order_release);
+
+        slot_ = nullptr;
+    }
+
+private:
+    ShmSlot *slot_at(const uint64_t i) const {
+        return reinterpret_cast<ShmSlot *>(
+            reinterpret_cast<uint8_t *>(header_) +
+            shm_align(sizeof(ShmHeader)) + i * header_->slot_stride);
+    }
+
+
+    static uint8_t *frame_at(ShmSlot *slot) {
+        return reinterpret_cast<uint8_t *>(slot) + shm_align(sizeof(ShmSlot));
+    }
+
+
+    std::string name_;
+    ShmHeader *header_;
+    size_t size_;
+    ShmSlot *slot_;
+};
+
+
+class ShmReader {
+public:
+    ShmReader() : header_(nullptr), size_(0), last_index_(0) {}
+
+    ~ShmReader() {
+        detach();
+    }
+
+
+    bool attach(const std::string &name) {
+        detach();
+
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 ||
+            static_cast<size_t>(st.st_size) < sizeof(ShmHeader)) {
+            ::close(fd);
+            return false;
+        }
+
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+
+        header_ = static_cast<const ShmHeader *>(addr);
+        size_ = st.st_size;
+
+        // The sizes are checked with divisions, the header could come from
+        // an unrelated object with the same name.
+        const size_t ring_size = size_ - shm_align(sizeof(ShmHeader));
+        if (header_->magic.load(std::memory_order_acquire) != shm_magic ||
+            header_->version != shm_version ||
+            size_ < shm_align(sizeof(ShmHeader)) ||
+            header_->n_slots < static_cast<uint32_t>(shm_min_slots) ||
+            header_->slot_stride < shm_align(sizeof(ShmSlot)) ||
+            header_->slot_stride > ring_size / header_->n_slots ||
+            header_->frame_capacity > header_->slot_stride) {
+            detach();
+            return false;
+        }
+
+        // Only samples published after attaching are new.
+        last_index_ = header_->write_index.load(std::memory_order_acquire);
+        return true;
+    }
+
+
+    void detach() {
+        if (header_) {
+            munmap(const_cast<ShmHeader *>(header_), size_);
+        }
+
+        header_ = nullptr;
+        size_ = 0;
+    }
+
+
+    bool is_attached() const {
+        return header_ != nullptr;
+    }
+
+
+    /**
+     * False once the writer has closed the shared memory.
+     */
+    bool writer_alive() const {
+        return header_ &&
+            header_->magic.load(std::memory_order_acquire) == shm_magic;
+    }
+
+
+    /**
+     * Copies the latest published slot into sample, and the frame into
+     * frame unless it is null. Returns false if nothing new was published
+     * since the last call, or if the writer kept overwriting the slot while
+     * it was being copied.
+     */
+    bool read_latest(ShmSample &sample, cv::Mat *frame = nullptr) {
+        if (!header_) {
+            return false;
+        }
+
+        const uint64_t index = header_->write_index.load(
+            std::memory_order_acquire);
+        if (index == last_index_ || index == 0) {
+            return false;
+        }
+
+        const ShmSlot *slot = slot_at((index - 1) % header_->n_slots);
+
+        for (int attempt = 0; attempt < 3; attempt++) {
+            const uint32_t seq0 = slot->seq.load(std::memory_order_acquire);
+            if (seq0 & 1) {
+                continue;
+            }
+
+            sample.frame_id = slot->frame_id;
+            sample.capture_ns = slot->capture_ns;
+            sample.position_ms = slot->position_ms;
+            sample.publish_ns = slot->publish_ns;
+
+            const int n_poses = std::min(std::max(slot->n_poses, 0),
+                shm_max_poses);
+            sample.poses.assign(slot->poses, slot->poses + n_poses);
+
+            if (frame) {
+                const int rows = slot->rows;
+                const int cols = slot->cols;
+                const int type = slot->type;
+
+                if (rows > 0 && cols > 0 && static_cast<uint64_t>(rows) *
+                    cols * CV_ELEM_SIZE(type) <= header_->frame_capacity) {
+                    cv::Mat(rows, cols, type,
+                        const_cast<uint8_t *>(frame_at(slot))).copyTo(*frame);
+                } else {
+                    frame->release();
+                }
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) == seq0) {
+                last_index_ = index;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    const ShmSlot *slot_at(const uint64_t i) const {
+        return reinterpret_cast<const ShmSlot *>(
+            reinterpret_cast<const uint8_t *>(header_) +
+            shm_align(sizeof(ShmHeader)) + i * header_->slot_stride);
+    }
+
+
+    static const uint8_t *frame_at(const ShmSlot *slot) {
+        return reinterpret_cast<const uint8_t *>(slot) +
+            shm_align(sizeof(ShmSlot));
+    }
+
+
+    const ShmHeader *header_;
+    size_t size_;
+    uint64_t last_index_;
+};
+
+}  // namespace fdcl
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fdcl_dictionary.hpp"
+
+
+namespace {
+const char* about = "Create print-ready sheets of ArUco markers in bulk";
+const char* keys  =
+    "{@outprefix |<none> | Output prefix, pages are saved as "
+    "<prefix>_<page>.<format> }"
+    "{d        |       | dictionary: DICT_4X4_50=0, DICT_4X4_100=1, "
+    "DICT_4X4_250=2, DICT_4X4_1000=3, DICT_5X5_50=4, DICT_5X5_100=5, "
+    "DICT_5X5_250=6, DICT_5X5_1000=7, DICT_6X6_50=8, DICT_6X6_100=9, "
+    "DICT_6X6_250=10, DICT_6X6_1000=11, DICT_7X7_50=12, DICT_7X7_100=13, "
+    "DICT_7X7_250=14, DICT_7X7_1000=15, DICT_ARUCO_ORIGINAL = 16}"
+    "{cd       |       | Custom dictionary file from generate_dictionary, "
+    "overrides -d }"
+    "{first    | 0     | First marker id }"
+    "{last     | -1    | Last marker id, -1 for the whole dictionary }"
+    "{ms       | 200   | Marker size in pixels }"
+    "{bb       | 1     | Number of bits in marker borders }"
+    "{g        |       | Gap between markers in pixels. Default is ms/4 }"
+    "{cols     | 4     | Markers per row on a page }"
+    "{rows     | 5     | Marker rows on a page }"
+    "{f        | png   | Output format: png or svg }"
+    "{noid     | false | Do not print the marker ids }"
+    ;
+}
+
+
+/**
+ * Page layout, in pixels. Each tile holds a marker and its id below it.
+ */
+struct Layout {
+    int marker_px;
+    int gap_px;
+    int label_px;
+    int cols;
+    int rows;
+
+    int tile_width() const { return marker_px + gap_px; }
+    int tile_height() const { return marker_px + label_px + gap_px; }
+    int page_width() const { return cols * tile_width() + gap_px; }
+    int page_height() const { return rows * tile_height() + gap_px; }
+    int per_page() const { return cols * rows; }
+
+    cv::Point marker_origin(const int slot) const {
+        return cv::Point(gap_px + (slot % cols) * tile_width(),
+            gap_px + (slot / cols) * tile_height());
+    }
+};
+
+
+void render_png_page(const std::vector<cv::Mat> &rasters, const int first_id,
+    const int first, const int count, const Layout &layout,
+    const bool print_ids, cv::Mat &page) {
+
+    page.create(layout.page_height(), layout.page_width(), CV_8UC1);
+    page.setTo(255);
+
+    const double font_scale = layout.label_px / 40.0;
+
+    // Every tile is a disjoint region of the page.
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range &range) {
+        for (int slot = range.start; slot < range.end; slot++) {
+            const int i = first + slot;
+            const cv::Point origin = layout.marker_origin(slot);
+
+            cv::Mat marker = page(cv::Rect(origin,
+                cv::Size(layout.marker_px, layout.marker_px)));
+            cv::resize(rasters[i], marker, marker.size(), 0, 0,
+                cv::INTER_NEAREST);
+
+            if (print_ids) {
+                char label[32];
+                std::snprintf(label, sizeof(label), "%d", first_id + i);
+                cv::Mat tile = page(cv::Rect(origin,
+                    cv::Size(layout.marker_px,
+                    layout.marker_px + layout.label_px)));
+                cv::putText(tile, label,
+                    cv::Point(0, layout.marker_px + layout.label_px * 3 / 4),
+                    cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(0),
+                    std::max(1, layout.label_px / 20));
+            }
+        }
+    });
+}
+
+
+/**
+ * Writes the black cells of each marker as rectangles, merging the runs of
+ * black cells in a row. The markers stay sharp at any print size. Returns
+ * false if the file could not be written.
+ */
+bool write_svg_page(const std::vector<cv::Mat> &rasters, const int first_id,
+    const int first, const int count, const Layout &layout,
+    const bool print_ids, const std::string &path) {
+
+    std::vector<std::string> tiles(count);
+
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range &range) {
+        for (int slot = range.start; slot < range.end; slot++) {
+            const int i = first + slot;
+            const cv::Mat &raster = rasters[i];
+            const cv::Point origin = layout.marker_origin(slot);
+            const double cell = static_cast<double>(layout.marker_px) /
+                raster.cols;
+
+            std::ostringstream svg;
+            for (int r = 0; r < raster.rows; r++) {
+                const uchar *row = raster.ptr<uchar>(r);
+                int c = 0;
+                while (c < raster.cols) {
+                    if (row[c] != 0) {
+                        c++;
+                        continue;
+                    }
+
+                    int run = 1;
+                    while (c + run < raster.cols && row[c + run] == 0) {
+                        run++;
+                    }
+
+                    svg << "<rect x=\"" << origin.x + c * cell
+                        << "\" y=\"" << origin.y + r * cell
+                        << "\" width=\"" << run * cell
+                        << "\" height=\"" << cell << "\"/>\n";
+                    c += run;
+                }
+            }
+
+            if (print_ids) {
+                svg << "<text x=\"" << origin.x << "\" y=\""
+                    << origin.y + layout.marker_px + layout.label_px * 3 / 4
+                    << "\" font-family=\"sans-serif\" font-size=\""
+                    << layout.label_px * 3 / 4 << "\">" << first_id + i
+                    << "</text>\n";
+            }
+
+            tiles[slot] = svg.str();
+        }
+    });
+
+    std::ofstream out(path.c_str());
+    if (!out) {
+        return false;
+    }
+
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\""
+        << layout.page_width() << "\" height=\"" << layout.page_height()
+        << "\" viewBox=\"0 0 " << layout.page_width() << " "
+        << layout.page_height() << "\" shape-rendering=\"crispEdges\">\n"
+        << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+
+    for (int slot = 0; slot < count; slot++) {
+        out << tiles[slot];
+    }
+
+    out << "</svg>\n";
+    out.flush();
+    return out.good();
+}
+
+
+int main(int argc, char *argv[]) {
+    cv::CommandLineParser parser(argc, argv, keys);
+    parser.about(about);
+
+    if (argc < 3) {
+        parser.printMessage();
+        return 0;
+    }
+
+    int first_id = parser.get<int>("first");
+    int last_id = parser.get<int>("last");
+    int border_bits = parser.get<int>("bb");
+    std::string format = parser.get<std::string>("f");
+    bool print_ids = !parser.get<bool>("noid");
+
+    Layout layout;
+    layout.marker_px = parser.get<int>("ms");
+    layout.gap_px = layout.marker_px / 4;
+    if (parser.has("g")) {
+        layout.gap_px = parser.get<int>("g");
+    }
+    layout.label_px = print_ids ? std::max(16, layout.marker_px / 8) : 0;
+    layout.cols = parser.get<int>("cols");
+    layout.rows = parser.get<int>("rows");
+
+    std::string out_prefix = parser.get<std::string>(0);
+
+    if (!parser.check()) {
+        parser.printErrors();
+        return 0;
+    }
+
+    if (format != "png" && format != "svg") {
+        std::cerr << "Output format must be png or svg\n";
+        return 1;
+    }
+
+    if (layout.cols <= 0 || layout.rows <= 0 || layout.gap_px < 0) {
+        std::cerr << "Invalid page layout\n";
+        return 1;
+    }
+
+    cv::Ptr<cv::aruco::Dictionary> dictionary = fdcl::get_dictionary(parser);
+    if (!dictionary) {
+        return 1;
+    }
+
+    const int n_dictionary = dictionary->bytesList.rows;
+    if (last_id < 0) {
+        last_id = n_dictionary - 1;
+    }
+
+    if (first_id < 0 || last_id >= n_dictionary || first_id > last_id) {
+        std::cerr << "Marker ids must be within 0 and " << n_dictionary - 1
+            << "\n";
+        return 1;
+    }
+
+    const int bits = dictionary->markerSize + 2 * border_bits;
+    if (layout.marker_px < bits) {
+        std::cerr << "Marker size must be at least " << bits << " pixels\n";
+        return 1;
+    }
+
+    if (layout.marker_px % bits != 0) {
+        std::cerr << "Warning: marker size is not a multiple of " << bits
+            << " pixels, the cells will not all be the same size\n";
+    }
+
+    // Render the bit pattern of every marker once, at one pixel per bit.
+    // The pages only scale these up.
+    const int n_markers = last_id - first_id + 1;
+    std::vector<cv::Mat> rasters(n_markers);
+    cv::parallel_for_(cv::Range(0, n_markers), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            cv::aruco::drawMarker(dictionary, first_id + i, bits, rasters[i],
+                border_bits);
+        }
+    });
+
+    // Only one page is held in memory at a time.
+    const int n_pages = (n_markers + layout.per_page() - 1) /
+        layout.per_page();
+    cv::Mat page;
+
+    for (int p = 0; p < n_pages; p++) {
+        const int first = p * layout.per_page();
+        const int count = std::min(layout.per_page(), n_markers - first);
+
+        char path[1024];
+        std::snprintf(path, sizeof(path), "%s_%04d.%s", out_prefix.c_str(),
+            p, format.c_str());
+
+        bool written;
+        if (format == "svg") {
+            written = write_svg_page(rasters, first_id, first, count, layout,
+                print_ids, path);
+        } else {
+            render_png_page(rasters, first_id, first, count, layout,
+                print_ids, page);
+            written = cv::imwrite(path, page);
+        }
+
+        if (!written) {
+            std::cerr << "Failed to write " << path << "\n";
+            return 1;
+        }
+
+        std::cout << "Saved " << path << " (ids " << first_id + first
+            << " to " << first_id + first + count - 1 << ")\n";
+    }
+
+    return 0;
+}
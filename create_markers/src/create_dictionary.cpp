@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <opencv2/core.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fdcl_dictionary.hpp"
+
+
+namespace {
+const char* about = "Create a custom ArUco dictionary with the largest "
+    "inter-marker distance found";
+const char* keys  =
+    "{@outfile |<none> | Output dictionary file, e.g. dictionary.yml }"
+    "{n        |       | Number of markers }"
+    "{ms       |       | Marker size in bits, e.g. 5 for 5x5 markers }"
+    "{t        | 0     | Number of independent searches, 0 uses the number "
+    "of threads }"
+    "{s        | 0     | Random seed of the first search }";
+}
+
+
+int main(int argc, char *argv[]) {
+    cv::CommandLineParser parser(argc, argv, keys);
+    parser.about(about);
+
+    if (argc < 4) {
+        parser.printMessage();
+        return 0;
+    }
+
+    int n_markers = parser.get<int>("n");
+    int marker_size = parser.get<int>("ms");
+    int n_searches = parser.get<int>("t");
+    int seed = parser.get<int>("s");
+    std::string out = parser.get<std::string>(0);
+
+    if (!parser.check()) {
+        parser.printErrors();
+        return 0;
+    }
+
+    if (n_markers <= 0 || marker_size < 3) {
+        std::cerr << "Number of markers must be positive and the marker size "
+            "must be at least 3 bits\n";
+        return 1;
+    }
+
+    if (n_searches <= 0) {
+        n_searches = std::max(1, cv::getNumThreads());
+    }
+
+    // Each search is the greedy generation of OpenCV with its own seed. The
+    // searches are independent, so they run in parallel and the dictionary
+    // with the largest minimum distance wins.
+    std::mutex best_mutex;
+    cv::Ptr<cv::aruco::Dictionary> best;
+    int best_distance = -1, best_seed = seed;
+
+    cv::parallel_for_(cv::Range(0, n_searches), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            cv::Ptr<cv::aruco::Dictionary> dictionary =
+                cv::aruco::generateCustomDictionary(n_markers, marker_size,
+                seed + i);
+            int distance = fdcl::min_hamming_distance(*dictionary);
+
+            std::lock_guard<std::mutex> lock(best_mutex);
+            std::cout << "Search " << i << " (seed " << seed + i
+                << "): minimum distance " << distance << "\n";
+
+            if (distance > best_distance ||
+                (distance == best_distance && seed + i < best_seed)) {
+                best = dictionary;
+                best_distance = distance;
+                best_seed = seed + i;
+            }
+        }
+    });
+
+    best->maxCorrectionBits = (best_distance - 1) / 2;
+
+    if (!fdcl::save_dictionary(out, *best, best_distance)) {
+        std::cerr << "Cannot save output file " << out << "\n";
+        return 1;
+    }
+
+    std::cout << n_markers << " markers of " << marker_size << "x"
+        << marker_size << " bits, seed " << best_seed << "\n"
+        << "Minimum Hamming distance: " << best_distance << "\n"
+        << "Correctable bits: " << best->maxCorrectionBits << "\n"
+        << "Dictionary saved to " << out << "\n";
+
+    return 0;
+}
@@ -42,6 +42,8 @@ the use of this software, even if advised of the possibility of such damage.
 #include <opencv2/highgui.hpp>
 #include <opencv2/aruco.hpp>
 
+#include "fdcl_dictionary.hpp"
+
 using namespace cv;
 
 namespace {
@@ -52,6 +54,7 @@ const char* keys  =
         "DICT_4X4_1000=3, DICT_5X5_50=4, DICT_5X5_100=5, DICT_5X5_250=6, DICT_5X5_1000=7, "
         "DICT_6X6_50=8, DICT_6X6_100=9, DICT_6X6_250=10, DICT_6X6_1000=11, DICT_7X7_50=12,"
         "DICT_7X7_100=13, DICT_7X7_250=14, DICT_7X7_1000=15, DICT_ARUCO_ORIGINAL = 16}"
+        "{cd       |       | Custom dictionary file from generate_dictionary, overrides -d }"
         "{id       |       | Marker id in the dictionary }"
         "{ms       | 200   | Marker size in pixels }"
         "{bb       | 1     | Number of bits in marker borders }"
@@ -68,7 +71,6 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    int dictionaryId = parser.get<int>("d");
     int markerId = parser.get<int>("id");
     int borderBits = parser.get<int>("bb");
     int markerSize = parser.get<int>("ms");
@@ -81,8 +83,10 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    Ptr<aruco::Dictionary> dictionary =
-        aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(dictionaryId));
+    Ptr<aruco::Dictionary> dictionary = fdcl::get_dictionary(parser);
+    if(!dictionary) {
+        return 1;
+    }
 
     Mat markerImg;
     aruco::drawMarker(dictionary, markerId, markerSize, markerImg, borderBits);
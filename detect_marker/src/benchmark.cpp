@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+#include <iostream>
+#include <memory>
+#include <cstdio>
+#include <vector>
+
+#include "fdcl_common.hpp"
+#include "fdcl_dictionary.hpp"
+#include "fdcl_pose.hpp"
+#include "fdcl_preprocess.hpp"
+
+
+namespace {
+const char* about = "Compare the cv::Mat and the cv::UMat (OpenCL) detection "
+    "pipelines on this machine";
+const char* keys  =
+    "{@input   |../../test_data/test_image.png | Image or video used for "
+    "the benchmark }"
+    "{d        |16    | dictionary, see detect_markers }"
+    "{cd       |      | Custom dictionary file, overrides -d }"
+    "{n        |200   | Number of timed iterations for each pipeline }"
+    "{c        |      | Camera calibration file, enables undistortion and "
+    "the pose stage }"
+    "{l        |0.3   | Marker length in meter for the pose stage }"
+    "{h        |false | Print help }"
+    ;
+}
+
+
+struct BenchmarkResult {
+    double preprocess_ms;
+    double detect_ms;
+    double pose_ms;
+    size_t n_markers;
+};
+
+
+/**
+ * The pose stage is skipped if pose_estimator is null.
+ */
+BenchmarkResult run_pipeline(fdcl::FramePreprocessor &preprocessor,
+    const std::vector<cv::Mat> &frames,
+    const cv::Ptr<cv::aruco::Dictionary> &dictionary,
+    fdcl::MarkerPoseEstimator *pose_estimator, const int n) {
+
+    cv::Mat gray;
+    std::vector<int> ids;
+    std::vector<std::vector<cv::Point2f> > corners;
+    std::vector<fdcl::PoseVec> rvecs, tvecs;
+
+    // Warm up, the first OpenCL calls also compile the kernels.
+    for (int i = 0; i < 5; i++) {
+        preprocessor.process(frames[i % frames.size()], gray);
+        cv::aruco::detectMarkers(gray, dictionary, corners, ids);
+    }
+
+    BenchmarkResult result;
+    result.n_markers = 0;
+
+    cv::TickMeter preprocess_timer, detect_timer, pose_timer;
+    for (int i = 0; i < n; i++) {
+        preprocess_timer.start();
+        preprocessor.process(frames[i % frames.size()], gray);
+        preprocess_timer.stop();
+
+        detect_timer.start();
+        cv::aruco::detectMarkers(gray, dictionary, corners, ids);
+        detect_timer.stop();
+
+        if (pose_estimator) {
+            pose_timer.start();
+            pose_estimator->estimate(corners, rvecs, tvecs);
+            pose_timer.stop();
+        }
+
+        result.n_markers += ids.size();
+    }
+
+    result.preprocess_ms = preprocess_timer.getTimeMilli() / n;
+    result.detect_ms = detect_timer.getTimeMilli() / n;
+    result.pose_ms = pose_timer.getTimeMilli() / n;
+    return result;
+}
+
+
+void print_result(const char *name, const BenchmarkResult &result,
+    const int n) {
+
+    const double total_ms = result.preprocess_ms + result.detect_ms +
+        result.pose_ms;
+    std::printf("%-6s %14.3f %12.3f %10.3f %12.3f %10.1f %10.2f\n", name,
+        result.preprocess_ms, result.detect_ms, result.pose_ms, total_ms,
+        1000.0 / total_ms, static_cast<double>(result.n_markers) / n);
+}
+
+
+int main(int argc, char **argv) {
+    cv::CommandLineParser parser(argc, argv, keys);
+
+    auto success = parse_inputs(parser, about);
+    if (!success) {
+        return 1;
+    }
+
+    cv::String input = parser.get<cv::String>(0);
+    int n = parser.get<int>("n");
+    if (n <= 0) {
+        std::cerr << "Number of iterations must be positive\n";
+        return 1;
+    }
+
+    // Load the frames up front so that decoding is not timed.
+    std::vector<cv::Mat> frames;
+    cv::Mat image = cv::imread(input, cv::IMREAD_COLOR);
+    if (!image.empty()) {
+        frames.push_back(image);
+    } else {
+        cv::VideoCapture in_video;
+        open_video_from_arg(input, in_video);
+        while (frames.size() < 100 && in_video.read(image)) {
+            frames.push_back(image.clone());
+        }
+    }
+
+    if (frames.empty()) {
+        std::cerr << "Failed to read any frame from " << input << "\n";
+        return 1;
+    }
+
+    cv::Ptr<cv::aruco::Dictionary> dictionary = fdcl::get_dictionary(parser);
+    if (!dictionary) {
+        return 1;
+    }
+
+    fdcl::FramePreprocessor mat_preprocessor, umat_preprocessor;
+    mat_preprocessor.set_opencl(false);
+    bool have_ocl = umat_preprocessor.set_opencl(true);
+
+    std::unique_ptr<fdcl::MarkerPoseEstimator> pose_estimator;
+    if (parser.has("c")) {
+        cv::Mat camera_matrix, dist_coeffs;
+        cv::FileStorage fs(parser.get<cv::String>("c"),
+            cv::FileStorage::READ);
+        fs["camera_matrix"] >> camera_matrix;
+        fs["distortion_coefficients"] >> dist_coeffs;
+
+        if (camera_matrix.empty()) {
+            std::cerr << "Failed to read the camera calibration\n";
+            return 1;
+        }
+
+        mat_preprocessor.set_undistort(camera_matrix, dist_coeffs);
+        umat_preprocessor.set_undistort(camera_matrix, dist_coeffs);
+
+        // The corners are detected in the undistorted image.
+        pose_estimator.reset(new fdcl::MarkerPoseEstimator(
+            parser.get<float>("l"), camera_matrix,
+            cv::Mat::zeros(dist_coeffs.size(), dist_coeffs.type())));
+    }
+
+    std::cout << frames.size() << " frame(s) of " << frames[0].cols << "x"
+        << frames[0].rows << ", " << n << " iterations, "
+        << (sizeof(fdcl::pose_t) == sizeof(float) ? "float32" : "float64")
+        << " pose storage (float64 solver), " << cv::getNumThreads() << " threads\n";
+    std::printf("%-6s %14s %12s %10s %12s %10s %10s\n", "path",
+        "preprocess ms", "detect ms", "pose ms", "total ms", "fps",
+        "markers");
+
+    BenchmarkResult mat_result = run_pipeline(mat_preprocessor, frames,
+        dictionary, pose_estimator.get(), n);
+    print_result("Mat", mat_result, n);
+
+    if (have_ocl) {
+        BenchmarkResult umat_result = run_pipeline(umat_preprocessor, frames,
+            dictionary, pose_estimator.get(), n);
+        print_result("UMat", umat_result, n);
+    } else {
+        std::cout << "UMat   skipped, no OpenCL device available\n";
+    }
+
+    return 0;
+}
@@ -27,6 +27,9 @@
 #include <cstdlib>
 
 #include "fdcl_common.hpp"
+#include "fdcl_config.hpp"
+#include "fdcl_dictionary.hpp"
+#include "fdcl_preprocess.hpp"
 
 
 int main(int argc, char **argv)
@@ -39,19 +42,39 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    fdcl::PipelineConfig config;
+    if (!fdcl::parse_pipeline_config(parser, config)) {
+        return 1;
+    }
+
+    const fdcl::CommandLineArgs args(parser, argc, argv, config);
+    fdcl::read_common_args(args, config);
+    fdcl::apply_performance_modes(config);
+
     cv::VideoCapture in_video;
-    success = parse_video_in(in_video, parser);
+    success = fdcl::open_video(in_video, config);
     if (!success) {
         return 1;
     }
 
-    int dictionary_id = parser.get<int>("d");
     int wait_time = 10;
 
     // Create the dictionary from the same dictionary the marker was generated.
-    cv::Ptr<cv::aruco::Dictionary> dictionary =
-        cv::aruco::getPredefinedDictionary( \
-        cv::aruco::PREDEFINED_DICTIONARY_NAME(dictionary_id));
+    cv::Ptr<cv::aruco::Dictionary> dictionary = fdcl::get_dictionary(config);
+    if (!dictionary) {
+        return 1;
+    }
+
+    cv::Ptr<cv::aruco::DetectorParameters> detector_params =
+        fdcl::get_detector_parameters(config);
+    if (!detector_params) {
+        return 1;
+    }
+    fdcl::DetectorParamsReloader detector_params_reloader(config);
+
+    fdcl::FramePreprocessor preprocessor;
+    preprocessor.set_opencl(config.opencl);
+    cv::Mat gray;
 
 
     // Process the video
@@ -62,16 +85,21 @@ int main(int argc, char **argv)
         
         std::vector<int> ids;
         std::vector<std::vector<cv::Point2f>> corners;
-        cv::aruco::detectMarkers(image, dictionary, corners, ids);
+        preprocessor.process(image, gray);
+        detector_params_reloader.poll(detector_params);
+        cv::aruco::detectMarkers(gray, dictionary, corners, ids,
+            detector_params);
         
         if (ids.size() > 0) {
             cv::aruco::drawDetectedMarkers(image_copy, corners, ids);
         }
 
-        imshow("Detected markers", image_copy);
-        char key = (char)cv::waitKey(wait_time);
-        if (key == 27) {
-            break;
+        if (config.display) {
+            imshow("Detected markers", image_copy);
+            char key = (char)cv::waitKey(wait_time);
+            if (key == 27) {
+                break;
+            }
         }
     }
 
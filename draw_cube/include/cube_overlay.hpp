@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __CUBE_OVERLAY_HPP__
+#define __CUBE_OVERLAY_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <vector>
+
+#include "fdcl_pose.hpp"
+
+
+/**
+ * Draws the cube wireframes of all the detected markers in a frame.
+ *
+ * The cube vertices are built once, and the vertices of every marker are
+ * transformed to the camera frame and projected with a single call to
+ * cv::projectPoints. The edges are rasterized into a single channel overlay
+ * layer, which is composited onto the image once per frame. Only the region
+ * touched by the previous and the current frame is cleared and composited,
+ * so the cost does not depend on the image size.
+ */
+class CubeOverlay {
+public:
+    CubeOverlay(const float l, const cv::Scalar &color = cv::Scalar(255, 0, 0),
+        const int thickness = 3) : color_(color), thickness_(thickness) {
+
+        const float half_l = l / 2.0;
+
+        vertices_[0] = cv::Point3f(half_l, half_l, l);
+        vertices_[1] = cv::Point3f(half_l, -half_l, l);
+        vertices_[2] = cv::Point3f(-half_l, -half_l, l);
+        vertices_[3] = cv::Point3f(-half_l, half_l, l);
+        vertices_[4] = cv::Point3f(half_l, half_l, 0);
+        vertices_[5] = cv::Point3f(half_l, -half_l, 0);
+        vertices_[6] = cv::Point3f(-half_l, -half_l, 0);
+        vertices_[7] = cv::Point3f(-half_l, half_l, 0);
+    }
+
+
+    void render(
+        cv::Mat &image, const cv::Mat &camera_matrix,
+        const cv::Mat &dist_coeffs, const std::vector<fdcl::PoseVec> &rvecs,
+        const std::vector<fdcl::PoseVec> &tvecs
+    ) {
+        if (layer_.size() != image.size()) {
+            layer_.create(image.size(), CV_8UC1);
+            layer_.setTo(0);
+            dirty_ = cv::Rect();
+        }
+
+        // Clear only what was drawn on the previous frame.
+        if (dirty_.area() > 0) {
+            layer_(dirty_).setTo(0);
+        }
+
+        const size_t n_markers = std::min(rvecs.size(), tvecs.size());
+        if (n_markers == 0) {
+            dirty_ = cv::Rect();
+            return;
+        }
+
+        // Transform the static cube of each marker to the camera frame.
+        camera_points_.resize(8 * n_markers);
+        for (size_t i = 0; i < n_markers; i++) {
+            fdcl::PoseMat R;
+            cv::Rodrigues(rvecs[i], R);
+            const fdcl::PoseVec &t = tvecs[i];
+
+            for (int j = 0; j < 8; j++) {
+                const cv::Point3f &v = vertices_[j];
+                camera_points_[8 * i + j] = cv::Point3f(
+                    R(0, 0) * v.x + R(0, 1) * v.y + R(0, 2) * v.z + t(0),
+                    R(1, 0) * v.x + R(1, 1) * v.y + R(1, 2) * v.z + t(1),
+                    R(2, 0) * v.x + R(2, 1) * v.y + R(2, 2) * v.z + t(2)
+                );
+            }
+        }
+
+        // Project every vertex at once, the points are already in the
+        // camera frame.
+        cv::projectPoints(
+            camera_points_, cv::Vec3d::all(0), cv::Vec3d::all(0),
+            camera_matrix, dist_coeffs, image_points_
+        );
+
+        faces_.resize(2 * n_markers);
+        edges_.resize(4 * n_markers);
+        for (size_t i = 0; i < n_markers; i++) {
+            const cv::Point2f *p = &image_points_[8 * i];
+
+            std::vector<cv::Point> &top = faces_[2 * i];
+            std::vector<cv::Point> &bottom = faces_[2 * i + 1];
+            top.resize(4);
+            bottom.resize(4);
+            for (int j = 0; j < 4; j++) {
+                top[j] = p[j];
+                bottom[j] = p[j + 4];
+
+                std::vector<cv::Point> &edge = edges_[4 * i + j];
+                edge.resize(2);
+                edge[0] = p[j];
+                edge[1] = p[j + 4];
+            }
+        }
+
+        cv::polylines(layer_, faces_, true, cv::Scalar(255), thickness_);
+        cv::polylines(layer_, edges_, false, cv::Scalar(255), thickness_);
+
+        // Composite only the region covered by the cubes.
+        cv::Rect current = cv::boundingRect(image_points_);
+        current -= cv::Point(thickness_, thickness_);
+        current += cv::Size(2 * thickness_ + 1, 2 * thickness_ + 1);
+        current &= cv::Rect(cv::Point(0, 0), image.size());
+
+        dirty_ = current;
+        if (dirty_.area() > 0) {
+            image(dirty_).setTo(color_, layer_(dirty_));
+        }
+    }
+
+private:
+    cv::Point3f vertices_[8];
+    cv::Scalar color_;
+    int thickness_;
+
+    std::vector<cv::Point3f> camera_points_;
+    std::vector<cv::Point2f> image_points_;
+    std::vector<std::vector<cv::Point> > faces_;
+    std::vector<std::vector<cv::Point> > edges_;
+
+    cv::Mat layer_;
+    cv::Rect dirty_;
+};
+
+#endif
@@ -30,22 +30,32 @@
 #include <cstdlib>
 
 #include "fdcl_common.hpp"
+#include "fdcl_config.hpp"
+#include "fdcl_dictionary.hpp"
+#include "fdcl_pose.hpp"
+#include "fdcl_preprocess.hpp"
+#include "cube_overlay.hpp"
 
 
-void drawCubeWireframe(
-    cv::InputOutputArray image, cv::InputArray camera_matrix,
-    cv::InputArray dist_coeffs, cv::InputArray rvec, cv::InputArray tvec,
-    float l
-);
-
 void drawText(
     cv::InputOutputArray image, const std::string &name, const double value, 
     const cv::Point place
 );
 
 
+namespace {
+const char* draw_cube_keys =
+    "{o        |out.avi | Output video with the drawn cubes, empty disables "
+    "it }"
+    "{fps      |0     | Frame rate of the output video, 0 uses the rate of "
+    "the source }"
+    ;
+}
+
+
 int main(int argc, char **argv) {
-    cv::CommandLineParser parser(argc, argv, fdcl::keys);
+    cv::CommandLineParser parser(argc, argv,
+        cv::String(fdcl::keys) + draw_cube_keys);
 
     const char* about = "Draw cube on ArUco marker images";
     auto success = parse_inputs(parser, about);
@@ -53,16 +63,26 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    fdcl::PipelineConfig config;
+    if (!fdcl::parse_pipeline_config(parser, config)) {
+        return 1;
+    }
+
+    const fdcl::CommandLineArgs args(parser, argc, argv, config);
+    fdcl::read_common_args(args, config);
+    args.read("o", config.output_video);
+    args.read("fps", config.output_fps);
+    fdcl::apply_performance_modes(config);
+
     cv::VideoCapture in_video;
-    success = parse_video_in(in_video, parser);
+    success = fdcl::open_video(in_video, config);
     if (!success) {
         return 1;
     }
 
     int wait_time = 10;
     
-    int dictionary_id = parser.get<int>("d");
-    float marker_length_m = parser.get<float>("l");
+    float marker_length_m = config.marker_length;
     if (marker_length_m <= 0) {
         std::cerr << "Marker length must be a positive value in meter\n";
         return 1;
@@ -72,24 +92,48 @@ int main(int argc, char **argv) {
     cv::Mat camera_matrix, dist_coeffs;
     
     // Create the dictionary from the same dictionary the marker was generated.
-    cv::Ptr<cv::aruco::Dictionary> dictionary =
-        cv::aruco::getPredefinedDictionary( \
-        cv::aruco::PREDEFINED_DICTIONARY_NAME(dictionary_id));
+    cv::Ptr<cv::aruco::Dictionary> dictionary = fdcl::get_dictionary(config);
+    if (!dictionary) {
+        return 1;
+    }
 
+    cv::Ptr<cv::aruco::DetectorParameters> detector_params =
+        fdcl::get_detector_parameters(config);
+    if (!detector_params) {
+        return 1;
+    }
+    fdcl::DetectorParamsReloader detector_params_reloader(config);
 
-    cv::FileStorage fs("../../calibration_params.yml", cv::FileStorage::READ);
-    fs["camera_matrix"] >> camera_matrix;
-    fs["distortion_coefficients"] >> dist_coeffs;
+    CubeOverlay cube_overlay(marker_length_m);
 
+    fdcl::FramePreprocessor preprocessor;
+    preprocessor.set_opencl(config.opencl);
+    cv::Mat gray;
 
-    // Initialize a video writer to save the drawn cube.
+    if (!fdcl::read_camera_parameters(config, camera_matrix, dist_coeffs)) {
+        return 1;
+    }
+    fdcl::MarkerPoseEstimator pose_estimator(marker_length_m, camera_matrix,
+        dist_coeffs);
+
+
+    // Initialize a video writer to save the drawn cube, at the rate of the
+    // source unless one is given.
     int frame_width = in_video.get(cv::CAP_PROP_FRAME_WIDTH);
     int frame_height = in_video.get(cv::CAP_PROP_FRAME_HEIGHT);
-    int fps = 30;
+    double fps = config.output_fps;
+    if (fps <= 0) {
+        fps = in_video.get(cv::CAP_PROP_FPS);
+    }
+    if (fps <= 0) {
+        fps = 30;
+    }
     int fourcc = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
-    cv::VideoWriter video(
-        "out.avi", fourcc, fps, cv::Size(frame_width, frame_height), true
-    );
+    cv::VideoWriter video;
+    if (!config.output_video.empty()) {
+        video.open(config.output_video, fourcc, fps,
+            cv::Size(frame_width, frame_height), true);
+    }
 
 
     while (in_video.grab()) {
@@ -98,7 +142,10 @@ int main(int argc, char **argv) {
 
         std::vector<int> ids;
         std::vector<std::vector<cv::Point2f>> corners;
-        cv::aruco::detectMarkers(image, dictionary, corners, ids);
+        preprocessor.process(image, gray);
+        detector_params_reloader.poll(detector_params);
+        cv::aruco::detectMarkers(gray, dictionary, corners, ids,
+            detector_params);
 
 
         // If at least one marker is detected
@@ -106,36 +153,34 @@ int main(int argc, char **argv) {
         {
             cv::aruco::drawDetectedMarkers(image_copy, corners, ids);
             
-            std::vector<cv::Vec3d> rvecs, tvecs;
-            cv::aruco::estimatePoseSingleMarkers(
-                corners, marker_length_m, camera_matrix, dist_coeffs,
-                rvecs, tvecs
+            std::vector<fdcl::PoseVec> rvecs, tvecs;
+            pose_estimator.estimate(corners, rvecs, tvecs);
+
+            // Draw the cubes of all the markers at once
+            cube_overlay.render(
+                image_copy, camera_matrix, dist_coeffs, rvecs, tvecs
             );
 
-            // Draw axis for each marker
-            for (int i = 0; i < ids.size(); i++)
-            {
-                drawCubeWireframe(
-                    image_copy, camera_matrix, dist_coeffs, rvecs[i], tvecs[i],
-                    marker_length_m
-                );
-
-                // This section is going to print the data for the first the 
-                // detected marker. If you have more than a single marker, it is 
-                // recommended to change the below section so that either you
-                // only print the data for a specific marker, or you print the
-                // data for each marker separately.
-                drawText(image_copy, "x", tvecs[0](0), cv::Point(10, 30));
-                drawText(image_copy, "y", tvecs[0](1), cv::Point(10, 50));
-                drawText(image_copy, "z", tvecs[0](2), cv::Point(10, 70));
-            }
+            // This section is going to print the data for the first the 
+            // detected marker. If you have more than a single marker, it is 
+            // recommended to change the below section so that either you
+            // only print the data for a specific marker, or you print the
+            // data for each marker separately.
+            drawText(image_copy, "x", tvecs[0](0), cv::Point(10, 30));
+            drawText(image_copy, "y", tvecs[0](1), cv::Point(10, 50));
+            drawText(image_copy, "z", tvecs[0](2), cv::Point(10, 70));
+        }
+
+        if (video.isOpened()) {
+            video.write(image_copy);
         }
 
-        video.write(image_copy);
-        cv::imshow("Pose estimation", image_copy);
-        char key = (char)cv::waitKey(wait_time);
-        if (key == 27) {
-            break;
+        if (config.display) {
+            cv::imshow("Pose estimation", image_copy);
+            char key = (char)cv::waitKey(wait_time);
+            if (key == 27) {
+                break;
+            }
         }
     }
 
@@ -143,42 +188,3 @@ int main(int argc, char **argv) {
 
     return 0;
 }
-
-void drawCubeWireframe(
-    cv::InputOutputArray image, cv::InputArray camera_matrix,
-    cv::InputArray dist_coeffs, cv::InputArray rvec, cv::InputArray tvec,
-    float l
-)
-{
-    float half_l = l / 2.0;
-
-    // Project cube points
-    std::vector<cv::Point3f> axis_points;
-    axis_points.push_back(cv::Point3f(half_l, half_l, l));
-    axis_points.push_back(cv::Point3f(half_l, -half_l, l));
-    axis_points.push_back(cv::Point3f(-half_l, -half_l, l));
-    axis_points.push_back(cv::Point3f(-half_l, half_l, l));
-    axis_points.push_back(cv::Point3f(half_l, half_l, 0));
-    axis_points.push_back(cv::Point3f(half_l, -half_l, 0));
-    axis_points.push_back(cv::Point3f(-half_l, -half_l, 0));
-    axis_points.push_back(cv::Point3f(-half_l, half_l, 0));
-
-    std::vector<cv::Point2f> image_points;
-    projectPoints(
-        axis_points, rvec, tvec, camera_matrix, dist_coeffs, image_points
-    );
-
-    // Draw cube edges lines
-    cv::line(image, image_points[0], image_points[1], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[0], image_points[3], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[0], image_points[4], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[1], image_points[2], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[1], image_points[5], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[2], image_points[3], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[2], image_points[6], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[3], image_points[7], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[4], image_points[5], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[4], image_points[7], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[5], image_points[6], cv::Scalar(255, 0, 0), 3);
-    cv::line(image, image_points[6], image_points[7], cv::Scalar(255, 0, 0), 3);
-}
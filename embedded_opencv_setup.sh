@@ -0,0 +1,28 @@
+# Static OpenCV for the embedded build profile, cross compiled for aarch64,
+# with only the modules the detector uses. Run from the repository root:
+#   sh embedded_opencv_setup.sh
+# then build the tools with:
+#   mkdir build_aarch64 && cd build_aarch64
+#   cmake -DCMAKE_TOOLCHAIN_FILE=../cmake/aarch64-linux-gnu.cmake -DFDCL_EMBEDDED=ON \
+#       -DOpenCV_DIR=../libraries/install_aarch64/lib/cmake/opencv4 ..
+#   make -j4 && make benchmark
+git submodule update --init
+
+cd ./libraries/opencv
+mkdir build_aarch64
+cd ./build_aarch64
+cmake -DCMAKE_BUILD_TYPE=Release \
+    -DCMAKE_TOOLCHAIN_FILE=../../../cmake/aarch64-linux-gnu.cmake \
+    -DCMAKE_INSTALL_PREFIX=../../install_aarch64 \
+    -DOPENCV_EXTRA_MODULES_PATH=../../opencv_contrib/modules \
+    -DBUILD_LIST=core,imgproc,imgcodecs,videoio,highgui,calib3d,features2d,flann,aruco \
+    -DBUILD_SHARED_LIBS=OFF -DENABLE_LTO=ON \
+    -DBUILD_ZLIB=ON -DBUILD_PNG=ON -DBUILD_JPEG=ON -DWITH_TIFF=OFF -DWITH_WEBP=OFF \
+    -DWITH_OPENEXR=OFF -DWITH_JASPER=OFF -DWITH_OPENJPEG=OFF \
+    -DWITH_FFMPEG=OFF -DWITH_GSTREAMER=OFF -DWITH_GTK=OFF -DWITH_V4L=ON \
+    -DWITH_OPENCL=OFF -DWITH_IPP=OFF -DWITH_ITT=OFF \
+    -DBUILD_TESTS=OFF -DBUILD_PERF_TESTS=OFF -DBUILD_EXAMPLES=OFF -DBUILD_opencv_apps=OFF \
+    ..
+make -j4
+make install
+cd ../../../
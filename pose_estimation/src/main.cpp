@@ -23,15 +23,66 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
+#include <opencv2/aruco/charuco.hpp>
 #include <iostream>
 #include <cstdlib>
+#include <memory>
 
+#include "fdcl_board.hpp"
 #include "fdcl_common.hpp"
+#include "fdcl_confidence.hpp"
+#include "fdcl_config.hpp"
+#include "fdcl_dictionary.hpp"
+#include "fdcl_frame.hpp"
+#include "fdcl_metrics.hpp"
+#include "fdcl_pose.hpp"
+#include "fdcl_preprocess.hpp"
+#include "fdcl_shm.hpp"
+
+
+namespace {
+const char* pose_keys =
+    "{cw       |      | Number of ChArUco squares in X direction, "
+    "enables ChArUco board pose }"
+    "{ch       |      | Number of ChArUco squares in Y direction }"
+    "{sl       |      | ChArUco square side length in meter }"
+    "{bw       |      | Number of GridBoard markers in X direction, enables "
+    "GridBoard pose }"
+    "{bh       |      | Number of GridBoard markers in Y direction }"
+    "{bs       |      | GridBoard marker separation in meter }"
+    "{bt       |true  | Track the GridBoard pose, and search the markers "
+    "missing from a frame around their predicted position }"
+    "{bp       |0.5   | Padding of the searched regions, relative to the "
+    "marker size }"
+    "{ud       |false | Remove the lens distortion before detection }"
+    "{shm      |      | Publish frames and poses to this POSIX shared "
+    "memory name, e.g. /fdcl_pose }"
+    "{shm_slots|4     | Number of slots in the shared memory ring buffer }"
+    "{rec      |      | Record the raw frames and their timestamps to this "
+    "file }"
+    "{rp       |      | Replay a recorded file instead of a video source }"
+    "{rf       |false | Replay as fast as possible instead of at the "
+    "recorded pacing }"
+    "{lf       |false | Latest frame wins: grab the live source in a "
+    "separate thread and only process the newest frame }"
+    "{ma       |0     | With --lf, maximum age of a frame in ms, older frames "
+    "are dropped, 0 disables it }"
+    "{rb       |false | Robust detection for blur and low light, with a "
+    "confidence for each marker }"
+    "{rbe      |normalize | Enhancement of the undecoded candidate regions "
+    "in robust mode: none, normalize, sharpen or normalize+sharpen }"
+    "{mp       |0     | Serve Prometheus metrics at "
+    "http://127.0.0.1:<mp>/metrics, 0 disables it }"
+    "{mf       |      | Write Prometheus metrics to this file every second, "
+    "for the node exporter textfile collector }"
+    ;
+}
 
 
 int main(int argc, char **argv)
 {
-    cv::CommandLineParser parser(argc, argv, fdcl::keys);
+    cv::CommandLineParser parser(argc, argv,
+        cv::String(fdcl::keys) + pose_keys);
 
     const char* about = "Pose estimation of ArUco marker images";
 
@@ -40,14 +91,79 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    cv::VideoCapture in_video;
-    success = parse_video_in(in_video, parser);
-    if (!success) {
+    // A config file given with --cfg sets up the pipeline, and the keys
+    // given explicitly on the command line override it.
+    fdcl::PipelineConfig config;
+    if (!fdcl::parse_pipeline_config(parser, config)) {
         return 1;
     }
 
-    int dictionary_id = parser.get<int>("d");
-    float marker_length_m = parser.get<float>("l");
+    const fdcl::CommandLineArgs args(parser, argc, argv, config);
+    fdcl::read_common_args(args, config);
+    args.read("cw", config.charuco_squares_x);
+    args.read("ch", config.charuco_squares_y);
+    args.read("sl", config.charuco_square_length);
+    args.read("bw", config.board_markers_x);
+    args.read("bh", config.board_markers_y);
+    args.read("bs", config.board_marker_separation);
+    args.read("bt", config.board_tracking);
+    args.read("bp", config.board_roi_padding);
+    args.read("ud", config.undistort);
+    args.read("shm", config.shm);
+    args.read("shm_slots", config.shm_slots);
+    args.read("rec", config.record);
+    args.read("rp", config.replay);
+    args.read("rf", config.replay_as_fast);
+    args.read("rb", config.robust);
+    args.read("rbe", config.robust_enhancement);
+    args.read("mp", config.metrics_port);
+    args.read("mf", config.metrics_file);
+    args.read("lf", config.latest_frame);
+    args.read("ma", config.max_frame_age_ms);
+
+    if (!parser.check()) {
+        parser.printErrors();
+        return 1;
+    }
+    fdcl::apply_performance_modes(config);
+
+    // Frames either come from a video source, or from a recording which is
+    // replayed with its original timestamps.
+    cv::VideoCapture in_video;
+    std::unique_ptr<fdcl::FrameSource> source;
+    if (!config.replay.empty()) {
+        std::unique_ptr<fdcl::ReplaySource> replay(new fdcl::ReplaySource);
+        success = replay->open(config.replay, !config.replay_as_fast);
+        if (!success) {
+            return 1;
+        }
+        source = std::move(replay);
+    } else {
+        success = fdcl::open_video(in_video, config);
+        if (!success) {
+            return 1;
+        }
+
+        // For closed loop control, a fresh pose at a lower rate is worth more
+        // than every pose with a growing delay, so in the latest frame mode
+        // the frames that cannot be processed in time are skipped.
+        if (config.latest_frame) {
+            source.reset(new fdcl::LatestFrameSource(in_video,
+                config.max_frame_age_ms));
+        } else {
+            source.reset(new fdcl::CaptureSource(in_video));
+        }
+    }
+
+    fdcl::FrameRecorder recorder;
+    if (!config.record.empty()) {
+        success = recorder.open(config.record);
+        if (!success) {
+            return 1;
+        }
+    }
+
+    float marker_length_m = config.marker_length;
     int wait_time = 10;
 
     if (marker_length_m <= 0) {
@@ -61,42 +177,318 @@ int main(int argc, char **argv)
     std::ostringstream vector_to_marker;
 
     // Create the dictionary from the same dictionary the marker was generated.
-    cv::Ptr<cv::aruco::Dictionary> dictionary =
-        cv::aruco::getPredefinedDictionary( \
-        cv::aruco::PREDEFINED_DICTIONARY_NAME(dictionary_id));
+    cv::Ptr<cv::aruco::Dictionary> dictionary = fdcl::get_dictionary(config);
+    if (!dictionary) {
+        return 1;
+    }
+
+    // The detector parameters can be tuned while the stream is running, they
+    // are reloaded whenever their file changes.
+    cv::Ptr<cv::aruco::DetectorParameters> detector_params =
+        fdcl::get_detector_parameters(config);
+    if (!detector_params) {
+        return 1;
+    }
+    fdcl::DetectorParamsReloader detector_params_reloader(config);
+
+    // When a ChArUco board is given, the pose of the whole board is estimated
+    // from the interpolated chessboard corners, which are refined to sub-pixel
+    // accuracy, in addition to the pose of each marker.
+    cv::Ptr<cv::aruco::CharucoBoard> charuco_board;
+    if (config.charuco_squares_x > 0 || config.charuco_squares_y > 0 ||
+        config.charuco_square_length > 0) {
+        int squares_x = config.charuco_squares_x;
+        int squares_y = config.charuco_squares_y;
+        float square_length_m = config.charuco_square_length;
+
+        if (squares_x < 2 || squares_y < 2) {
+            std::cerr << "ChArUco board needs at least 2 squares in each "
+                "direction\n";
+            return 1;
+        }
+
+        if (square_length_m <= marker_length_m) {
+            std::cerr << "Square length must be larger than the marker "
+                "length\n";
+            return 1;
+        }
+
+        charuco_board = cv::aruco::CharucoBoard::create(squares_x, squares_y,
+            square_length_m, marker_length_m, dictionary);
+    }
+
+    cv::Ptr<cv::aruco::GridBoard> grid_board;
+    if (config.board_markers_x > 0 || config.board_markers_y > 0 ||
+        config.board_marker_separation > 0) {
+        if (config.board_markers_x < 1 || config.board_markers_y < 1) {
+            std::cerr << "GridBoard needs at least 1 marker in each "
+                "direction\n";
+            return 1;
+        }
+
+        if (config.board_marker_separation <= 0) {
+            std::cerr << "GridBoard marker separation must be a positive "
+                "value in meter\n";
+            return 1;
+        }
+
+        grid_board = cv::aruco::GridBoard::create(config.board_markers_x,
+            config.board_markers_y, marker_length_m,
+            config.board_marker_separation, dictionary);
+    }
+
+
+    if (!fdcl::read_camera_parameters(config, camera_matrix, dist_coeffs)) {
+        return 1;
+    }
 
+    // The poses are estimated from the corners in the image detection ran on.
+    // If the lens distortion is removed before detection, those corners
+    // follow the pinhole model and the poses use zero distortion. The
+    // overlays are then drawn on the undistorted frame, with zero distortion
+    // too, so that they line up with the detection.
+    fdcl::FramePreprocessor preprocessor;
+    preprocessor.set_opencl(config.opencl);
+
+    cv::Mat detection_dist_coeffs = dist_coeffs;
+    if (config.undistort) {
+        preprocessor.set_undistort(camera_matrix, dist_coeffs);
+        detection_dist_coeffs = cv::Mat::zeros(dist_coeffs.size(),
+            dist_coeffs.type());
+    }
+    fdcl::MarkerPoseEstimator pose_estimator(marker_length_m, camera_matrix,
+        detection_dist_coeffs);
+    cv::Mat gray;
 
-    cv::FileStorage fs("../../calibration_params.yml", cv::FileStorage::READ);
-    fs["camera_matrix"] >> camera_matrix;
-    fs["distortion_coefficients"] >> dist_coeffs;
+    // In robust mode, each marker is scored from its decoded bits, and the
+    // candidates that could not be decoded are retried after enhancing only
+    // their regions.
+    std::unique_ptr<fdcl::RobustDetector> robust_detector;
+    if (config.robust) {
+        int enhancement;
+        if (!fdcl::parse_roi_enhancement(config.robust_enhancement,
+            enhancement)) {
+            std::cerr << "Unknown robust mode enhancement "
+                << config.robust_enhancement << "\n";
+            return 1;
+        }
+
+        robust_detector.reset(new fdcl::RobustDetector(dictionary,
+            detector_params, enhancement));
+    }
 
+    // When parts of the GridBoard are occluded, the markers missing from
+    // the detection are searched again only around where the previous board
+    // pose projects them.
+    std::unique_ptr<fdcl::BoardTracker> board_tracker;
+    if (grid_board) {
+        board_tracker.reset(new fdcl::BoardTracker(grid_board,
+            detector_params, camera_matrix, detection_dist_coeffs,
+            config.board_tracking, config.board_roi_padding));
+    }
+
+    // Frames and poses can be shared with other processes on this machine
+    // through a shared memory ring buffer. It is created once the first frame
+    // gives the frame size, and the following frames are captured straight
+    // into its slots.
+    fdcl::ShmWriter shm_writer;
+    const std::string &shm_name = config.shm;
+    int shm_slots = config.shm_slots;
+    if (!shm_name.empty() && (shm_slots < fdcl::shm_min_slots ||
+        shm_slots > fdcl::shm_max_slots)) {
+        std::cerr << "Number of shared memory slots must be between "
+            << fdcl::shm_min_slots << " and " << fdcl::shm_max_slots << "\n";
+        return 1;
+    }
+
+    // The metrics are updated with relaxed atomics from this loop, and
+    // rendered by the exporters from their own threads.
+    fdcl::MetricsRegistry metrics;
+    fdcl::Counter &frames_total = metrics.counter("fdcl_frames_total",
+        "Frames processed");
+    fdcl::Gauge &fps = metrics.gauge("fdcl_fps",
+        "Frames processed per second, averaged over the last second");
+    const char *stage_names[] = {"capture", "preprocess", "detect", "pose",
+        "publish"};
+    enum {CAPTURE, PREPROCESS, DETECT, POSE, PUBLISH, N_STAGES};
+    std::vector<fdcl::Histogram *> stage_latency;
+    for (int i = 0; i < N_STAGES; i++) {
+        stage_latency.push_back(&metrics.histogram(
+            "fdcl_stage_latency_seconds", "Latency of each pipeline stage",
+            fdcl::latency_buckets(),
+            "stage=\"" + std::string(stage_names[i]) + "\""));
+    }
+    fdcl::Histogram &frame_latency = metrics.histogram(
+        "fdcl_frame_latency_seconds",
+        "Latency from the capture of a frame to its poses being published",
+        fdcl::latency_buckets());
+    fdcl::Gauge &frame_age = metrics.gauge("fdcl_frame_age_seconds",
+        "Age of the last frame when its processing started");
+    fdcl::Gauge &markers_per_frame = metrics.gauge("fdcl_markers_per_frame",
+        "Markers detected in the last frame");
+    fdcl::Counter &markers_total = metrics.counter("fdcl_markers_total",
+        "Markers detected");
+    const int n_ids = dictionary->bytesList.rows;
+    fdcl::IdCounter &dropouts = metrics.id_counter(
+        "fdcl_marker_dropouts_total",
+        "Markers detected in a frame but not in the following one", n_ids);
+    fdcl::Counter &capture_errors = metrics.counter(
+        "fdcl_capture_errors_total", "Frames the source failed to deliver");
+    fdcl::Counter &frames_skipped = metrics.counter(
+        "fdcl_frames_skipped_total",
+        "Frames dropped before processing in the latest frame mode",
+        "reason=\"replaced\"");
+    fdcl::Counter &frames_stale = metrics.counter(
+        "fdcl_frames_skipped_total",
+        "Frames dropped before processing in the latest frame mode",
+        "reason=\"stale\"");
+    fdcl::Counter &markers_recovered = metrics.counter(
+        "fdcl_board_markers_recovered_total",
+        "GridBoard markers found around their predicted position");
 
-    while (in_video.grab())
+    fdcl::HttpExporter http_exporter;
+    if (config.metrics_port > 0) {
+        if (!http_exporter.start(metrics, config.metrics_port)) {
+            return 1;
+        }
+    }
+
+    fdcl::TextfileExporter textfile_exporter;
+    if (!config.metrics_file.empty()) {
+        if (!textfile_exporter.start(metrics, config.metrics_file)) {
+            return 1;
+        }
+    }
+
+    // The source keeps its own totals, which are added to the counters as
+    // they grow.
+    auto report = [](fdcl::Counter &counter, uint64_t total) {
+        counter.inc(total - counter.value());
+    };
+
+    std::vector<bool> seen(n_ids, false), seen_now(n_ids, false);
+    int64_t fps_start_ns = fdcl::monotonic_ns();
+    int fps_frames = 0;
+
+    fdcl::Frame frame;
+    for (;;)
     {
-        in_video.retrieve(image);
-        image.copyTo(image_copy);
+        int64_t stage_ns = fdcl::monotonic_ns();
+        auto end_stage = [&](int stage) {
+            const int64_t now = fdcl::monotonic_ns();
+            stage_latency[stage]->observe((now - stage_ns) * 1e-9);
+            stage_ns = now;
+        };
+
+        if (shm_writer.is_open()) {
+            frame.image = shm_writer.acquire(image.size(), image.type());
+        }
+
+        bool read = source->read(frame);
+        report(capture_errors, source->errors());
+        report(frames_skipped, source->skipped());
+        report(frames_stale, source->stale());
+        if (!read) {
+            break;
+        }
+        end_stage(CAPTURE);
+        frame_age.set((stage_ns - frame.arrival_ns) * 1e-9);
+
+        image = frame.image;
+        preprocessor.undistort(image, image_copy);
+
+        if (recorder.is_open()) {
+            recorder.write(frame);
+        }
+
+        if (!shm_name.empty() && !shm_writer.is_open()) {
+            bool created = shm_writer.create(shm_name, shm_slots,
+                image.total() * image.elemSize());
+            if (!created) {
+                return 1;
+            }
+            std::cout << "Publishing to shared memory " << shm_name << "\n";
+        }
 
         std::vector<int> ids;
         std::vector<std::vector<cv::Point2f> > corners;
-        cv::aruco::detectMarkers(image, dictionary, corners, ids);
+        std::vector<fdcl::PoseVec> rvecs, tvecs;
+        std::vector<fdcl::MarkerScore> scores;
+        std::vector<float> confidences;
+        preprocessor.process(image, gray);
+        end_stage(PREPROCESS);
+
+        if (detector_params_reloader.poll(detector_params)) {
+            if (robust_detector) {
+                robust_detector->set_parameters(detector_params);
+            }
+            if (board_tracker) {
+                board_tracker->set_parameters(detector_params);
+            }
+        }
+
+        if (robust_detector) {
+            robust_detector->detect(gray, corners, ids, scores);
+            for (size_t i = 0; i < scores.size(); i++) {
+                confidences.push_back(scores[i].confidence);
+            }
+        } else {
+            cv::aruco::detectMarkers(gray, dictionary, corners, ids,
+                detector_params);
+        }
+
+        if (board_tracker) {
+            const size_t n_detected = ids.size();
+            markers_recovered.inc(board_tracker->recover(gray, corners, ids));
+            for (size_t i = n_detected; robust_detector && i < ids.size();
+                i++) {
+                confidences.push_back(robust_detector->score(gray,
+                    corners[i], ids[i]).confidence);
+            }
+        }
+        end_stage(DETECT);
+
+        seen_now.assign(n_ids, false);
+        for (size_t i = 0; i < ids.size(); i++) {
+            seen_now[ids[i]] = true;
+        }
+        for (int id = 0; id < n_ids; id++) {
+            if (seen[id] && !seen_now[id]) {
+                dropouts.inc(id);
+            }
+        }
+        seen.swap(seen_now);
+        markers_per_frame.set(ids.size());
+        markers_total.inc(ids.size());
 
         // if at least one marker detected
         if (ids.size() > 0)
         {
             cv::aruco::drawDetectedMarkers(image_copy, corners, ids);
 
-            std::vector<cv::Vec3d> rvecs, tvecs;
-            cv::aruco::estimatePoseSingleMarkers(corners, marker_length_m,
-                    camera_matrix, dist_coeffs, rvecs, tvecs);
+            pose_estimator.estimate(corners, rvecs, tvecs);
                     
-            std::cout << "Translation: " << tvecs[0]
-                << "\tRotation: " << rvecs[0] << "\n";
+            std::cout << "Frame: " << frame.id
+                << "\tTime: " << frame.capture_ns << " ns"
+                << "\tTranslation: " << tvecs[0]
+                << "\tRotation: " << rvecs[0];
+            if (!confidences.empty()) {
+                std::cout << "\tConfidence: " << confidences[0];
+            }
+            std::cout << "\tLatency: "
+                << (fdcl::monotonic_ns() - frame.arrival_ns) * 1e-6
+                << " ms\n";
             
             // Draw axis for each marker
             for(int i=0; i < ids.size(); i++)
             {
-                cv::aruco::drawAxis(image_copy, camera_matrix, dist_coeffs,
-                        rvecs[i], tvecs[i], 0.1);
+                cv::aruco::drawAxis(image_copy, camera_matrix,
+                        detection_dist_coeffs, rvecs[i], tvecs[i], 0.1);
+
+                if (!confidences.empty()) {
+                    drawText(image_copy, "conf", confidences[i],
+                        corners[i][0]);
+                }
 
                 // This section is going to print the data for the first the 
                 // detected marker. If you have more than a single marker, it is 
@@ -107,15 +499,83 @@ int main(int argc, char **argv)
                 drawText(image_copy, "y", tvecs[0](1), cv::Point(10, 50));
                 drawText(image_copy, "z", tvecs[0](2), cv::Point(10, 70));
             }
+
+            if (charuco_board) {
+                cv::Mat charuco_corners, charuco_ids;
+                cv::aruco::interpolateCornersCharuco(corners, ids, gray,
+                    charuco_board, charuco_corners, charuco_ids,
+                    camera_matrix, detection_dist_coeffs);
+
+                cv::Vec3d board_rvec, board_tvec;
+                bool valid = charuco_ids.total() > 0 &&
+                    cv::aruco::estimatePoseCharucoBoard(charuco_corners,
+                        charuco_ids, charuco_board, camera_matrix,
+                        detection_dist_coeffs, board_rvec, board_tvec);
+
+                if (valid) {
+                    cv::aruco::drawDetectedCornersCharuco(image_copy,
+                        charuco_corners, charuco_ids);
+                    cv::aruco::drawAxis(image_copy, camera_matrix,
+                        detection_dist_coeffs, board_rvec, board_tvec, 0.1);
+
+                    std::cout << "Frame: " << frame.id
+                        << "\tTime: " << frame.capture_ns << " ns"
+                        << "\tBoard translation: " << board_tvec
+                        << "\tBoard rotation: " << board_rvec
+                        << "\tLatency: "
+                        << (fdcl::monotonic_ns() - frame.arrival_ns) * 1e-6
+                        << " ms\n";
+                }
+            }
         }
 
-        imshow("Pose estimation", image_copy);
-        char key = (char)cv::waitKey(wait_time);
-        if (key == 27) {
-            break;
+        // The tracker also needs the frames without markers, to stop
+        // tracking.
+        if (board_tracker) {
+            cv::Vec3d board_rvec, board_tvec;
+            if (board_tracker->estimate(corners, ids, board_rvec,
+                board_tvec)) {
+                cv::aruco::drawAxis(image_copy, camera_matrix,
+                    detection_dist_coeffs, board_rvec, board_tvec, 0.1);
+
+                std::cout << "Frame: " << frame.id
+                    << "\tTime: " << frame.capture_ns << " ns"
+                    << "\tGridBoard translation: " << board_tvec
+                    << "\tGridBoard rotation: " << board_rvec
+                    << "\tLatency: "
+                    << (fdcl::monotonic_ns() - frame.arrival_ns) * 1e-6
+                    << " ms\n";
+            }
+        }
+
+        end_stage(POSE);
+
+        if (shm_writer.is_open()) {
+            shm_writer.publish(frame, ids, rvecs, tvecs, confidences);
+        }
+        end_stage(PUBLISH);
+        frame_latency.observe((stage_ns - frame.arrival_ns) * 1e-9);
+
+        frames_total.inc();
+        fps_frames++;
+        if (stage_ns - fps_start_ns >= 1000000000) {
+            fps.set(fps_frames * 1e9 / (stage_ns - fps_start_ns));
+            fps_start_ns = stage_ns;
+            fps_frames = 0;
+        }
+
+        if (config.display) {
+            imshow("Pose estimation", image_copy);
+            char key = (char)cv::waitKey(wait_time);
+            if (key == 27) {
+                break;
+            }
         }
     }
 
+    // The grabber thread of the latest frame mode is stopped before the
+    // video source is released.
+    source.reset();
     in_video.release();
 
     return 0;
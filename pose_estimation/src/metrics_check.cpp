@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+// Checks the Prometheus text exposition of fdcl_metrics.hpp, as a scraper
+// would see it.
+//
+// Without arguments, it serves a registry like the one of pose_estimation
+// on a free port, scrapes it over HTTP, and also checks the textfile
+// exporter. With a port, it scrapes a running pose_estimation --mp=<port>
+// instead.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fdcl_metrics.hpp"
+
+
+namespace {
+
+bool http_get(const int port, const std::string &path, std::string &status,
+    std::string &headers, std::string &body) {
+
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address),
+        sizeof(address)) != 0) {
+        std::cerr << "Failed to connect to 127.0.0.1:" << port << "\n";
+        close(fd);
+        return false;
+    }
+
+    const std::string request = "GET " + path + " HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\nConnection: close\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+        static_cast<ssize_t>(request.size())) {
+        close(fd);
+        return false;
+    }
+
+    std::string response;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, n);
+    }
+    close(fd);
+
+    const size_t end_of_status = response.find("\r\n");
+    const size_t end_of_headers = response.find("\r\n\r\n");
+    if (end_of_status == std::string::npos ||
+        end_of_headers == std::string::npos) {
+        std::cerr << "Malformed HTTP response\n";
+        return false;
+    }
+
+    status = response.substr(0, end_of_status);
+    headers = response.substr(end_of_status + 2,
+        end_of_headers - end_of_status - 2);
+    body = response.substr(end_of_headers + 4);
+    return true;
+}
+
+
+/**
+ * Checks the syntax of every line, that each family has one HELP and one
+ * TYPE line before its samples, that the samples of a family are grouped,
+ * and that the histogram buckets are cumulative and end with +Inf.
+ */
+bool validate_exposition(const std::string &text, std::string &error) {
+    const std::string name = "[a-zA-Z_:][a-zA-Z0-9_:]*";
+    const std::string label = "[a-zA-Z_][a-zA-Z0-9_]*=\"(?:[^\"\\\\\\n]|"
+        "\\\\.)*\"";
+    const std::string value = "[-+]?(?:[0-9]+(?:\\.[0-9]*)?|\\.[0-9]+)"
+        "(?:[eE][-+]?[0-9]+)?|[-+]?Inf|NaN";
+
+    const std::regex help_line("# HELP (" + name + ") .*");
+    const std::regex type_line("# TYPE (" + name + ") "
+        "(counter|gauge|histogram|summary|untyped)");
+    const std::regex sample_line("(" + name + ")(?:\\{((?:" + label +
+        ")(?:," + label + ")*)?\\})? (" + value + ")(?: -?[0-9]+)?");
+    const std::regex le_label("(^|,)le=\"([^\"]*)\"");
+
+    if (text.empty() || text[text.size() - 1] != '\n') {
+        error = "The exposition must end with a newline";
+        return false;
+    }
+
+    std::map<std::string, std::string> types;
+    std::set<std::string> helps, finished;
+    std::string current;
+
+    // Per histogram series: the last bucket, the +Inf bucket and the count
+    std::map<std::string, double> last_bucket, inf_bucket, counts;
+
+    std::istringstream lines(text);
+    std::string line;
+    int number = 0;
+    while (std::getline(lines, line)) {
+        number++;
+        const std::string where = "line " + std::to_string(number) + ": ";
+        std::smatch match;
+
+        if (line.empty()) {
+            continue;
+        }
+
+        if (std::regex_match(line, match, help_line)) {
+            if (!helps.insert(match[1]).second) {
+                error = where + "second HELP for " + match[1].str();
+                return false;
+            }
+            continue;
+        }
+
+        if (std::regex_match(line, match, type_line)) {
+            if (types.count(match[1])) {
+                error = where + "second TYPE for " + match[1].str();
+                return false;
+            }
+            types[match[1]] = match[2];
+            continue;
+        }
+
+        if (line[0] == '#') {
+            continue;
+        }
+
+        if (!std::regex_match(line, match, sample_line)) {
+            error = where + "not a sample: " + line;
+            return false;
+        }
+
+        std::string family = match[1];
+        const std::string labels = match[2];
+        const double sample = std::strtod(match[3].str().c_str(), nullptr);
+
+        std::string suffix;
+        const char *suffixes[] = {"_bucket", "_sum", "_count"};
+        for (int i = 0; i < 3 && !types.count(family); i++) {
+            const size_t n = std::strlen(suffixes[i]);
+            if (family.size() > n &&
+                family.compare(family.size() - n, n, suffixes[i]) == 0 &&
+                types.count(family.substr(0, family.size() - n)) &&
+                types[family.substr(0, family.size() - n)] == "histogram") {
+                family = family.substr(0, family.size() - n);
+                suffix = suffixes[i];
+            }
+        }
+
+        if (!types.count(family)) {
+            error = where + "no TYPE before the samples of " + family;
+            return false;
+        }
+        if (family != current) {
+            if (finished.count(family)) {
+                error = where + "samples of " + family + " are not grouped";
+                return false;
+            }
+            if (!current.empty()) {
+                finished.insert(current);
+            }
+            current = family;
+        }
+
+        if (types[family] != "histogram") {
+            continue;
+        }
+        if (suffix.empty()) {
+            error = where + "histogram sample without a suffix";
+            return false;
+        }
+
+        std::smatch le;
+        const std::string series = family + "{" +
+            std::regex_replace(labels, le_label, "") + "}";
+        if (suffix == "_bucket") {
+            if (!std::regex_search(labels, le, le_label)) {
+                error = where + "bucket without an le label";
+                return false;
+            }
+            if (last_bucket.count(series) && sample < last_bucket[series]) {
+                error = where + "buckets of " + series + " decrease";
+                return false;
+            }
+            last_bucket[series] = sample;
+            if (le[2] == "+Inf") {
+                inf_bucket[series] = sample;
+            }
+        } else if (suffix == "_count") {
+            counts[series] = sample;
+        }
+    }
+
+    for (std::map<std::string, double>::const_iterator it = counts.begin();
+        it != counts.end(); ++it) {
+        if (!inf_bucket.count(it->first) ||
+            inf_bucket[it->first] != it->second) {
+            error = "the +Inf bucket of " + it->first +
+                " does not match its count";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool expect(const std::string &text, const std::string &line) {
+    if (text.find(line + "\n") == std::string::npos) {
+        std::cerr << "Missing: " << line << "\n";
+        return false;
+    }
+    return true;
+}
+
+
+bool scrape(const int port, std::string &body) {
+    std::string status, headers;
+    if (!http_get(port, "/metrics", status, headers, body)) {
+        return false;
+    }
+
+    if (status.find(" 200 ") == std::string::npos) {
+        std::cerr << "Unexpected status: " << status << "\n";
+        return false;
+    }
+    if (headers.find("Content-Type: text/plain; version=0.0.4") ==
+        std::string::npos) {
+        std::cerr << "Missing the Prometheus text content type\n";
+        return false;
+    }
+    if (headers.find("Content-Length: " + std::to_string(body.size())) ==
+        std::string::npos) {
+        std::cerr << "Content-Length does not match the body\n";
+        return false;
+    }
+
+    std::string error;
+    if (!validate_exposition(body, error)) {
+        std::cerr << "Invalid exposition, " << error << "\n" << body;
+        return false;
+    }
+
+    return true;
+}
+
+
+int self_check() {
+    // The same kinds of metrics as pose_estimation, including the series
+    // which share a name.
+    fdcl::MetricsRegistry metrics;
+    fdcl::Counter &frames = metrics.counter("fdcl_frames_total",
+        "Frames processed");
+    fdcl::Gauge &fps = metrics.gauge("fdcl_fps",
+        "Frames processed per second");
+    fdcl::Histogram &detect = metrics.histogram("fdcl_stage_latency_seconds",
+        "Latency of each pipeline stage", fdcl::latency_buckets(),
+        "stage=\"detect\"");
+    fdcl::Histogram &pose = metrics.histogram("fdcl_stage_latency_seconds",
+        "Latency of each pipeline stage", fdcl::latency_buckets(),
+        "stage=\"pose\"");
+    fdcl::IdCounter &dropouts = metrics.id_counter(
+        "fdcl_marker_dropouts_total", "Markers lost from a frame", 50);
+    fdcl::Counter &replaced = metrics.counter("fdcl_frames_skipped_total",
+        "Frames dropped", "reason=\"replaced\"");
+    metrics.counter("fdcl_frames_skipped_total", "Frames dropped",
+        "reason=\"stale\"");
+
+    frames.inc(3);
+    fps.set(29.97);
+    detect.observe(0.004);
+    detect.observe(2.0);
+    pose.observe(0.0001);
+    dropouts.inc(7, 2);
+    replaced.inc();
+
+    fdcl::HttpExporter http_exporter;
+    if (!http_exporter.start(metrics, 0) || http_exporter.port() <= 0) {
+        return 1;
+    }
+
+    std::string body;
+    if (!scrape(http_exporter.port(), body)) {
+        return 1;
+    }
+
+    bool ok = expect(body, "# TYPE fdcl_frames_total counter") &&
+        expect(body, "fdcl_frames_total 3") &&
+        expect(body, "fdcl_fps 29.97") &&
+        expect(body, "fdcl_stage_latency_seconds_bucket{stage=\"detect\","
+            "le=\"0.005\"} 1") &&
+        expect(body, "fdcl_stage_latency_seconds_bucket{stage=\"detect\","
+            "le=\"+Inf\"} 2") &&
+        expect(body, "fdcl_stage_latency_seconds_count{stage=\"pose\"} 1") &&
+        expect(body, "fdcl_marker_dropouts_total{id=\"7\"} 2") &&
+        expect(body, "fdcl_frames_skipped_total{reason=\"replaced\"} 1") &&
+        expect(body, "fdcl_frames_skipped_total{reason=\"stale\"} 0");
+
+    std::string status, headers, not_found;
+    if (!http_get(http_exporter.port(), "/other", status, headers,
+        not_found) || status.find(" 404 ") == std::string::npos) {
+        std::cerr << "Paths other than /metrics must return 404\n";
+        ok = false;
+    }
+    http_exporter.stop();
+
+    const std::string path = "/tmp/fdcl_metrics_check_" +
+        std::to_string(getpid()) + ".prom";
+    fdcl::TextfileExporter textfile_exporter;
+    if (!textfile_exporter.start(metrics, path, 50)) {
+        return 1;
+    }
+    frames.inc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    textfile_exporter.stop();
+
+    std::ifstream file(path.c_str());
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::remove(path.c_str());
+
+    std::string error;
+    if (!validate_exposition(contents.str(), error)) {
+        std::cerr << "Invalid textfile exposition, " << error << "\n";
+        ok = false;
+    }
+    ok = expect(contents.str(), "fdcl_frames_total 4") && ok;
+
+    if (!ok) {
+        return 1;
+    }
+
+    std::cout << "Metrics exposition is valid\n";
+    return 0;
+}
+
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        return self_check();
+    }
+
+    const int port = std::atoi(argv[1]);
+    if (port <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [port of a running "
+            "pose_estimation --mp]\n";
+        return 1;
+    }
+
+    std::string body;
+    if (!scrape(port, body)) {
+        return 1;
+    }
+
+    std::cout << body << "Metrics exposition is valid\n";
+    return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+#include <iostream>
+#include <cstdlib>
+
+#include "fdcl_common.hpp"
+#include "fdcl_config.hpp"
+#include "fdcl_frame.hpp"
+#include "fdcl_multiview.hpp"
+#include "fdcl_preprocess.hpp"
+
+
+namespace {
+const char* multiview_keys =
+    "{rig      |      | Rig file from camera_calibration_extrinsics }"
+    "{vs       |      | Comma separated video sources of the cameras, in the "
+    "order of the rig, e.g. 0,1 }"
+    "{ud       |false | Remove the lens distortion before detection }"
+    ;
+}
+
+
+int main(int argc, char **argv)
+{
+    cv::CommandLineParser parser(argc, argv,
+        cv::String(fdcl::keys) + multiview_keys);
+
+    const char* about = "Pose estimation of ArUco markers from a rig of "
+        "cameras";
+
+    auto success = parse_inputs(parser, about);
+    if (!success) {
+        return 1;
+    }
+
+    fdcl::PipelineConfig config;
+    if (!fdcl::parse_pipeline_config(parser, config)) {
+        return 1;
+    }
+
+    const fdcl::CommandLineArgs args(parser, argc, argv, config);
+    fdcl::read_common_args(args, config);
+    args.read("rig", config.rig);
+    args.read("vs", config.videos);
+    args.read("ud", config.undistort);
+    fdcl::apply_performance_modes(config);
+
+    float marker_length_m = config.marker_length;
+    if (marker_length_m <= 0) {
+        std::cerr << "Marker length must be a positive value in meter\n";
+        return 1;
+    }
+
+    std::vector<fdcl::CameraView> views;
+    if (config.rig.empty() || !fdcl::read_rig(config.rig, views)) {
+        std::cerr << "A rig file is required with --rig\n";
+        return 1;
+    }
+
+    const std::vector<std::string> sources = fdcl::split_list(config.videos);
+    if (sources.size() != views.size()) {
+        std::cerr << "The rig has " << views.size() << " cameras, but "
+            << sources.size() << " video sources are given with --vs\n";
+        return 1;
+    }
+
+    std::vector<cv::VideoCapture> in_videos(sources.size());
+    for (size_t i = 0; i < sources.size(); i++) {
+        open_video_from_arg(sources[i], in_videos[i]);
+        if (!in_videos[i].isOpened()) {
+            std::cerr << "Failed to open video input: " << sources[i] << "\n";
+            return 1;
+        }
+    }
+
+    cv::Ptr<cv::aruco::Dictionary> dictionary = fdcl::get_dictionary(config);
+    if (!dictionary) {
+        return 1;
+    }
+
+    cv::Ptr<cv::aruco::DetectorParameters> detector_params =
+        fdcl::get_detector_parameters(config);
+    if (!detector_params) {
+        return 1;
+    }
+    fdcl::DetectorParamsReloader detector_params_reloader(config);
+
+    // Each view is preprocessed like in pose_estimation. If its lens
+    // distortion is removed before detection, the estimator and the drawing
+    // use zero distortion for that view.
+    std::vector<fdcl::FramePreprocessor> preprocessors(views.size());
+    std::vector<fdcl::CameraView> detection_views = views;
+    for (size_t i = 0; i < views.size(); i++) {
+        preprocessors[i].set_opencl(config.opencl);
+        if (config.undistort) {
+            preprocessors[i].set_undistort(views[i].camera_matrix,
+                views[i].dist_coeffs);
+            detection_views[i].dist_coeffs = cv::Mat::zeros(
+                views[i].dist_coeffs.size(), views[i].dist_coeffs.type());
+        }
+    }
+
+    fdcl::MultiViewEstimator estimator(detection_views, dictionary,
+        detector_params, marker_length_m);
+
+    std::vector<cv::Mat> images(views.size()), grays(views.size());
+    std::vector<cv::Mat> image_copies(views.size());
+    std::vector<fdcl::MultiViewPose> poses;
+    int wait_time = 10;
+    uint64_t frame_id = 0;
+
+    for (;;)
+    {
+        // All the cameras are grabbed first, so that their frames are as
+        // close in time as possible, and decoded after.
+        bool grabbed = true;
+        for (size_t i = 0; i < in_videos.size(); i++) {
+            grabbed = in_videos[i].grab() && grabbed;
+        }
+        const int64_t capture_ns = fdcl::monotonic_ns();
+        if (!grabbed) {
+            break;
+        }
+
+        // A set with a missing view is skipped, rather than triangulated
+        // from stale or empty images.
+        bool retrieved = true;
+        for (size_t i = 0; i < in_videos.size(); i++) {
+            retrieved = in_videos[i].retrieve(images[i]) &&
+                !images[i].empty() && retrieved;
+        }
+        if (!retrieved) {
+            std::cerr << "Skipping frame " << frame_id
+                << ", a camera did not deliver its image\n";
+            frame_id++;
+            continue;
+        }
+
+        for (size_t i = 0; i < in_videos.size(); i++) {
+            preprocessors[i].process(images[i], grays[i]);
+        }
+
+        if (detector_params_reloader.poll(detector_params)) {
+            estimator.set_parameters(detector_params);
+        }
+        estimator.estimate(grays, poses);
+
+        // The poses are in the frame of the reference camera (camera 0).
+        for (size_t k = 0; k < poses.size(); k++) {
+            std::cout << "Frame: " << frame_id
+                << "\tTime: " << capture_ns << " ns"
+                << "\tId: " << poses[k].id
+                << "\tViews: " << poses[k].n_views
+                << "\tTranslation: " << poses[k].tvec
+                << "\tRotation: " << poses[k].rvec
+                << "\tFit RMS: " << poses[k].rms_m * 1e3 << " mm"
+                << "\tLatency: "
+                << (fdcl::monotonic_ns() - capture_ns) * 1e-6 << " ms\n";
+        }
+        frame_id++;
+
+        if (!config.display) {
+            continue;
+        }
+
+        // Draw the fused poses in every view, x = R x_0 + t, on the image
+        // the detection ran on.
+        for (size_t i = 0; i < views.size(); i++) {
+            preprocessors[i].undistort(images[i], image_copies[i]);
+            cv::aruco::drawDetectedMarkers(image_copies[i],
+                estimator.corners()[i], estimator.ids()[i]);
+
+            for (size_t k = 0; k < poses.size(); k++) {
+                cv::Matx33d R0;
+                cv::Rodrigues(poses[k].rvec, R0);
+                cv::Vec3d rvec;
+                cv::Rodrigues(views[i].R * R0, rvec);
+                const cv::Vec3d tvec = views[i].R * poses[k].tvec + views[i].t;
+
+                if (tvec(2) > 0) {
+                    cv::aruco::drawAxis(image_copies[i],
+                        views[i].camera_matrix, detection_views[i].dist_coeffs,
+                        rvec, tvec, 0.1);
+                }
+            }
+
+            cv::imshow("Camera " + std::to_string(i), image_copies[i]);
+        }
+
+        char key = (char)cv::waitKey(wait_time);
+        if (key == 27) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < in_videos.size(); i++) {
+        in_videos[i].release();
+    }
+
+    return 0;
+}
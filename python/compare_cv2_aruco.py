@@ -0,0 +1,131 @@
+"""
+Throughput of the fdcl_aruco bindings against calling cv2.aruco directly.
+
+Each thread runs its own stream over the same frames, with one detector per
+stream, and the frames per second of all the streams are added up.
+
+    python3 compare_cv2_aruco.py ../test_data/test_image.png -t 1 2 4
+"""
+
+import argparse
+import threading
+import time
+
+import cv2
+import numpy as np
+
+import fdcl_aruco
+
+
+def load_frames(path, max_frames):
+    image = cv2.imread(path)
+    if image is not None:
+        return [image]
+
+    frames = []
+    video = cv2.VideoCapture(path)
+    while len(frames) < max_frames:
+        ok, frame = video.read()
+        if not ok:
+            break
+        frames.append(frame)
+
+    if not frames:
+        raise SystemExit('Could not read frames from ' + path)
+    return frames
+
+
+def make_cv2_detect(dictionary_id):
+    if hasattr(cv2.aruco, 'ArucoDetector'):
+        detector = cv2.aruco.ArucoDetector(
+            cv2.aruco.getPredefinedDictionary(dictionary_id),
+            cv2.aruco.DetectorParameters())
+
+        def detect(frame):
+            gray = cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY)
+            return detector.detectMarkers(gray)[:2]
+    else:
+        dictionary = cv2.aruco.Dictionary_get(dictionary_id)
+        params = cv2.aruco.DetectorParameters_create()
+
+        def detect(frame):
+            gray = cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY)
+            return cv2.aruco.detectMarkers(gray, dictionary,
+                                           parameters=params)[:2]
+
+    return detect
+
+
+def make_fdcl_detect(dictionary_id):
+    detector = fdcl_aruco.Detector(dictionary=dictionary_id)
+    return detector.detect
+
+
+def run(make_detect, dictionary_id, frames, n_threads, iterations):
+    detects = [make_detect(dictionary_id) for _ in range(n_threads)]
+    for detect in detects:
+        detect(frames[0])
+
+    def stream(detect):
+        for i in range(iterations):
+            detect(frames[i % len(frames)])
+
+    threads = [threading.Thread(target=stream, args=(detect,))
+               for detect in detects]
+
+    start = time.perf_counter()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.perf_counter() - start
+
+    return n_threads * iterations / elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    parser.add_argument('input', nargs='?',
+                        default='../test_data/test_image.png',
+                        help='Image or video used for the comparison')
+    parser.add_argument('-d', type=int, default=16,
+                        help='Dictionary, see detect_markers')
+    parser.add_argument('-n', type=int, default=200,
+                        help='Frames per stream')
+    parser.add_argument('-t', type=int, nargs='+', default=[1, 2, 4],
+                        help='Numbers of parallel streams')
+    args = parser.parse_args()
+
+    frames = load_frames(args.input, args.n)
+    height, width = frames[0].shape[:2]
+    print('{} frame(s) of {}x{}, {} frames per stream'.format(
+        len(frames), width, height, args.n))
+
+    # Both detectors parallelize internally; a single OpenCV thread per
+    # stream shows how far the streams scale with Python threads alone.
+    for n_cv_threads, label in ((-1, 'default'), (1, '1')):
+        cv2.setNumThreads(n_cv_threads)
+        print('\nOpenCV threads: ' + label)
+        print('{:>8} {:>14} {:>14} {:>8}'.format(
+            'streams', 'cv2.aruco fps', 'fdcl_aruco fps', 'ratio'))
+
+        for n_threads in args.t:
+            cv2_fps = run(make_cv2_detect, args.d, frames, n_threads, args.n)
+            fdcl_fps = run(make_fdcl_detect, args.d, frames, n_threads,
+                           args.n)
+            print('{:>8} {:>14.1f} {:>14.1f} {:>8.2f}'.format(
+                n_threads, cv2_fps, fdcl_fps, fdcl_fps / cv2_fps))
+
+    # The results must match, the bindings only wrap the same detector.
+    cv2_corners, cv2_ids = make_cv2_detect(args.d)(frames[0])
+    fdcl_corners, fdcl_ids = make_fdcl_detect(args.d)(frames[0])
+    n_cv2 = 0 if cv2_ids is None else len(cv2_ids)
+    print('\nMarkers in the first frame: cv2.aruco {}, fdcl_aruco {}'.format(
+        n_cv2, len(fdcl_ids)))
+    if n_cv2 and not np.array_equal(np.sort(cv2_ids.ravel()),
+                                    np.sort(fdcl_ids)):
+        print('Warning: the detected ids differ')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "fdcl_config.hpp"
+#include "fdcl_confidence.hpp"
+#include "fdcl_dictionary.hpp"
+#include "fdcl_pose.hpp"
+#include "fdcl_preprocess.hpp"
+
+namespace py = pybind11;
+
+
+namespace {
+
+/**
+ * cv::Mat header over the buffer of a NumPy image, without copying it. The
+ * image must be uint8, HxW or HxWxC with 1 to 4 channels. Rows can be
+ * padded, e.g. a crop of a larger array. Other views, e.g. flipped
+ * (img[::-1]) or with skipped columns (img[:, ::2]), cannot be described
+ * by a cv::Mat step, so they are copied into a contiguous array first,
+ * which holder keeps alive as long as the returned Mat is used.
+ */
+cv::Mat mat_from_array(const py::array &array, py::array &holder) {
+    py::buffer_info info = array.request();
+
+    if (info.format != py::format_descriptor<uint8_t>::format()) {
+        throw std::invalid_argument("Images must be uint8 arrays");
+    }
+    if (info.ndim != 2 && info.ndim != 3) {
+        throw std::invalid_argument("Images must be HxW or HxWxC arrays");
+    }
+
+    const py::ssize_t channels = info.ndim == 3 ? info.shape[2] : 1;
+    if (channels < 1 || channels > 4) {
+        throw std::invalid_argument("Images must have 1 to 4 channels");
+    }
+
+    const bool zero_copy = info.strides[0] > 0 &&
+        info.strides[0] >= info.shape[1] * channels &&
+        info.strides[1] == channels &&
+        (info.ndim == 2 || info.strides[2] == 1);
+    if (!zero_copy) {
+        holder = py::array_t<uint8_t, py::array::c_style>::ensure(array);
+        if (!holder) {
+            throw std::invalid_argument("Images must be convertible to a "
+                "contiguous array");
+        }
+        info = holder.request();
+    }
+
+    return cv::Mat(static_cast<int>(info.shape[0]),
+        static_cast<int>(info.shape[1]), CV_8UC(static_cast<int>(channels)),
+        info.ptr, static_cast<size_t>(info.strides[0]));
+}
+
+
+cv::Mat matrix_from_array(const py::array_t<double,
+    py::array::c_style | py::array::forcecast> &array) {
+
+    const py::buffer_info info = array.request();
+    if (info.ndim == 1) {
+        return cv::Mat(1, static_cast<int>(info.shape[0]), CV_64F,
+            info.ptr).clone();
+    }
+    if (info.ndim != 2) {
+        throw std::invalid_argument("Calibration matrices must be 1D or 2D");
+    }
+
+    return cv::Mat(static_cast<int>(info.shape[0]),
+        static_cast<int>(info.shape[1]), CV_64F, info.ptr).clone();
+}
+
+
+py::array_t<double> array_from_matrix(const cv::Mat &matrix) {
+    cv::Mat values;
+    matrix.convertTo(values, CV_64F);
+    py::array_t<double> array({static_cast<py::ssize_t>(values.rows),
+        static_cast<py::ssize_t>(values.cols)});
+    std::copy(values.begin<double>(), values.end<double>(),
+        array.mutable_data());
+    return array;
+}
+
+
+std::vector<std::vector<cv::Point2f> > corners_from_array(
+    const py::array_t<float, py::array::c_style | py::array::forcecast>
+    &array) {
+
+    const py::buffer_info info = array.request();
+    if (array.size() == 0) {
+        return std::vector<std::vector<cv::Point2f> >();
+    }
+    if (info.ndim != 3 || info.shape[1] != 4 || info.shape[2] != 2) {
+        throw std::invalid_argument("Corners must be an Nx4x2 array");
+    }
+
+    const cv::Point2f *points = static_cast<const cv::Point2f *>(info.ptr);
+    std::vector<std::vector<cv::Point2f> > corners(info.shape[0]);
+    for (size_t i = 0; i < corners.size(); i++) {
+        corners[i].assign(points + 4 * i, points + 4 * i + 4);
+    }
+    return corners;
+}
+
+
+py::array_t<float> array_from_corners(
+    const std::vector<std::vector<cv::Point2f> > &corners) {
+
+    py::array_t<float> array({static_cast<py::ssize_t>(corners.size()),
+        static_cast<py::ssize_t>(4), static_cast<py::ssize_t>(2)});
+    float *data = array.mutable_data();
+    for (size_t i = 0; i < corners.size(); i++) {
+        for (int j = 0; j < 4; j++) {
+            data[8 * i + 2 * j] = corners[i][j].x;
+            data[8 * i + 2 * j + 1] = corners[i][j].y;
+        }
+    }
+    return array;
+}
+
+
+py::array_t<int> array_from_ids(const std::vector<int> &ids) {
+    py::array_t<int> array(static_cast<py::ssize_t>(ids.size()));
+    std::copy(ids.begin(), ids.end(), array.mutable_data());
+    return array;
+}
+
+
+py::array_t<fdcl::pose_t> array_from_poses(
+    const std::vector<fdcl::PoseVec> &poses) {
+
+    py::array_t<fdcl::pose_t> array({static_cast<py::ssize_t>(poses.size()),
+        static_cast<py::ssize_t>(3)});
+    fdcl::pose_t *data = array.mutable_data();
+    for (size_t i = 0; i < poses.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            data[3 * i + j] = poses[i](j);
+        }
+    }
+    return array;
+}
+
+
+/**
+ * Marker detection on NumPy images. The GIL is released while detecting, so
+ * several streams can run in parallel from Python threads, with one
+ * instance per stream. The calls on a single instance are serialized by its
+ * lock, since they share its buffers.
+ */
+class Detector {
+public:
+    Detector(const int dictionary, const std::string &custom_dictionary,
+        const std::string &detector_params, const bool opencl) {
+
+        config_.dictionary = dictionary;
+        config_.custom_dictionary = custom_dictionary;
+        config_.detector_params = detector_params;
+
+        dictionary_ = fdcl::get_dictionary(config_);
+        if (!dictionary_) {
+            throw std::invalid_argument("Invalid dictionary");
+        }
+
+        params_ = fdcl::get_detector_parameters(config_);
+        if (!params_) {
+            throw std::invalid_argument("Invalid detector parameters file " +
+                detector_params);
+        }
+
+        preprocessor_.set_opencl(opencl);
+    }
+
+
+    py::tuple detect(const py::array &image) {
+        py::array holder;
+        const cv::Mat frame = mat_from_array(image, holder);
+
+        std::vector<std::vector<cv::Point2f> > corners;
+        std::vector<int> ids;
+        {
+            // The lock is taken without the GIL, so that a thread waiting
+            // for it never blocks the one holding it.
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            preprocessor_.process(frame, gray_);
+            cv::aruco::detectMarkers(gray_, dictionary_, corners, ids,
+                params_);
+        }
+
+        return py::make_tuple(array_from_corners(corners),
+            array_from_ids(ids));
+    }
+
+private:
+    fdcl::PipelineConfig config_;
+    cv::Ptr<cv::aruco::Dictionary> dictionary_;
+    cv::Ptr<cv::aruco::DetectorParameters> params_;
+    fdcl::FramePreprocessor preprocessor_;
+
+    std::mutex mutex_;
+    cv::Mat gray_;
+};
+
+
+class PoseEstimator {
+public:
+    PoseEstimator(const float marker_length,
+        const py::array_t<double, py::array::c_style | py::array::forcecast>
+        &camera_matrix,
+        const py::array_t<double, py::array::c_style | py::array::forcecast>
+        &dist_coeffs) :
+        estimator_(marker_length, matrix_from_array(camera_matrix),
+            matrix_from_array(dist_coeffs)) {
+
+        if (marker_length <= 0) {
+            throw std::invalid_argument("Marker length must be positive");
+        }
+    }
+
+
+    py::tuple estimate(const py::array_t<float,
+        py::array::c_style | py::array::forcecast> &corners) {
+
+        const std::vector<std::vector<cv::Point2f> > points =
+            corners_from_array(corners);
+
+        std::vector<fdcl::PoseVec> rvecs, tvecs;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!points.empty()) {
+                estimator_.estimate(points, rvecs, tvecs);
+            }
+        }
+
+        return py::make_tuple(array_from_poses(rvecs),
+            array_from_poses(tvecs));
+    }
+
+private:
+    fdcl::MarkerPoseEstimator estimator_;
+    std::mutex mutex_;
+};
+
+
+/**
+ * The detection and pose pipeline of pose_estimation, set up from a
+ * pipeline config file (see pipeline.yml): dictionary, detector parameters
+ * (reloaded when their file changes), calibration, undistortion, robust
+ * detection and OpenCL. Like Detector, the GIL is released while
+ * processing, and the calls on a single instance are serialized.
+ */
+class Pipeline {
+public:
+    Pipeline(const std::string &config_path, const float marker_length) {
+        if (!config_path.empty() &&
+            !fdcl::load_pipeline_config(config_path, config_)) {
+            throw std::invalid_argument("Invalid pipeline config " +
+                config_path);
+        }
+        if (marker_length > 0) {
+            config_.marker_length = marker_length;
+        }
+        if (config_.marker_length <= 0) {
+            throw std::invalid_argument("Marker length must be positive");
+        }
+        fdcl::apply_performance_modes(config_);
+
+        dictionary_ = fdcl::get_dictionary(config_);
+        params_ = fdcl::get_detector_parameters(config_);
+        if (!dictionary_ || !params_) {
+            throw std::invalid_argument("Invalid dictionary or detector "
+                "parameters");
+        }
+        reloader_.reset(new fdcl::DetectorParamsReloader(config_));
+
+        cv::Mat camera_matrix, dist_coeffs;
+        if (!fdcl::read_camera_parameters(config_, camera_matrix,
+            dist_coeffs)) {
+            throw std::invalid_argument("Invalid camera calibration " +
+                config_.calibration);
+        }
+
+        preprocessor_.set_opencl(config_.opencl);
+        if (config_.undistort) {
+            preprocessor_.set_undistort(camera_matrix, dist_coeffs);
+            dist_coeffs = cv::Mat::zeros(dist_coeffs.size(),
+                dist_coeffs.type());
+        }
+        pose_estimator_.reset(new fdcl::MarkerPoseEstimator(
+            config_.marker_length, camera_matrix, dist_coeffs));
+
+        if (config_.robust) {
+            int enhancement;
+            if (!fdcl::parse_roi_enhancement(config_.robust_enhancement,
+                enhancement)) {
+                throw std::invalid_argument("Unknown robust mode "
+                    "enhancement " + config_.robust_enhancement);
+            }
+            robust_detector_.reset(new fdcl::RobustDetector(dictionary_,
+                params_, enhancement));
+        }
+    }
+
+
+    /**
+     * Returns a dict with ids (N), corners (Nx4x2), rvecs and tvecs (Nx3),
+     * and confidences (N, only in robust mode).
+     */
+    py::dict process(const py::array &image) {
+        py::array holder;
+        const cv::Mat frame = mat_from_array(image, holder);
+
+        std::vector<std::vector<cv::Point2f> > corners;
+        std::vector<int> ids;
+        std::vector<fdcl::MarkerScore> scores;
+        std::vector<fdcl::PoseVec> rvecs, tvecs;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            preprocessor_.process(frame, gray_);
+
+            if (reloader_->poll(params_) && robust_detector_) {
+                robust_detector_->set_parameters(params_);
+            }
+
+            if (robust_detector_) {
+                robust_detector_->detect(gray_, corners, ids, scores);
+            } else {
+                cv::aruco::detectMarkers(gray_, dictionary_, corners, ids,
+                    params_);
+            }
+
+            if (!ids.empty()) {
+                pose_estimator_->estimate(corners, rvecs, tvecs);
+            }
+        }
+
+        py::dict result;
+        result["ids"] = array_from_ids(ids);
+        result["corners"] = array_from_corners(corners);
+        result["rvecs"] = array_from_poses(rvecs);
+        result["tvecs"] = array_from_poses(tvecs);
+        if (robust_detector_) {
+            py::array_t<float> confidences(
+                static_cast<py::ssize_t>(scores.size()));
+            float *data = confidences.mutable_data();
+            for (size_t i = 0; i < scores.size(); i++) {
+                data[i] = scores[i].confidence;
+            }
+            result["confidences"] = confidences;
+        }
+        return result;
+    }
+
+private:
+    fdcl::PipelineConfig config_;
+    cv::Ptr<cv::aruco::Dictionary> dictionary_;
+    cv::Ptr<cv::aruco::DetectorParameters> params_;
+    std::unique_ptr<fdcl::DetectorParamsReloader> reloader_;
+    fdcl::FramePreprocessor preprocessor_;
+    std::unique_ptr<fdcl::MarkerPoseEstimator> pose_estimator_;
+    std::unique_ptr<fdcl::RobustDetector> robust_detector_;
+
+    std::mutex mutex_;
+    cv::Mat gray_;
+};
+
+
+py::tuple load_calibration(const std::string &path) {
+    fdcl::PipelineConfig config;
+    config.calibration = path;
+
+    cv::Mat camera_matrix, dist_coeffs;
+    if (!fdcl::read_camera_parameters(config, camera_matrix, dist_coeffs)) {
+        throw std::invalid_argument("Invalid camera calibration " + path);
+    }
+
+    return py::make_tuple(array_from_matrix(camera_matrix),
+        array_from_matrix(dist_coeffs));
+}
+
+}  // namespace
+
+
+PYBIND11_MODULE(fdcl_aruco, m) {
+    m.doc() = "ArUco marker detection and pose estimation of the FDCL "
+        "aruco-markers tools. Images are NumPy uint8 arrays, which are "
+        "used without copying.";
+
+    py::class_<Detector>(m, "Detector")
+        .def(py::init<int, const std::string &, const std::string &, bool>(),
+            py::arg("dictionary") = 16, py::arg("custom_dictionary") = "",
+            py::arg("detector_params") = "", py::arg("opencl") = false)
+        .def("detect", &Detector::detect, py::arg("image"),
+            "Returns the corners (Nx4x2 float32) and the ids (N int32) of "
+            "the markers in a gray or BGR image.");
+
+    py::class_<PoseEstimator>(m, "PoseEstimator")
+        .def(py::init<float,
+            const py::array_t<double, py::array::c_style |
+                py::array::forcecast> &,
+            const py::array_t<double, py::array::c_style |
+                py::array::forcecast> &>(),
+            py::arg("marker_length"), py::arg("camera_matrix"),
+            py::arg("dist_coeffs"))
+        .def("estimate", &PoseEstimator::estimate, py::arg("corners"),
+            "Returns the rvecs and the tvecs (Nx3) of the markers from "
+            "their corners (Nx4x2).");
+
+    py::class_<Pipeline>(m, "Pipeline")
+        .def(py::init<const std::string &, float>(), py::arg("config") = "",
+            py::arg("marker_length") = 0.0f)
+        .def("process", &Pipeline::process, py::arg("image"),
+            "Detects the markers and estimates their poses. Returns a dict "
+            "with ids, corners, rvecs, tvecs, and confidences in robust "
+            "mode.");
+
+    m.def("load_calibration", &load_calibration, py::arg("path"),
+        "Returns the camera matrix and the distortion coefficients of a "
+        "calibration file from camera_calibration.");
+
+    m.attr("float_poses") = sizeof(fdcl::pose_t) == sizeof(float);
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "fdcl_shm.hpp"
+
+
+namespace {
+const char* about = "Round trip frames and poses through the shared memory "
+    "ring buffer, check them, and report the latency";
+const char* keys  =
+    "{n        |1000  | Number of samples }"
+    "{s        |4     | Number of slots }"
+    "{r        |480   | Frame rows }"
+    "{c        |640   | Frame columns }"
+    "{max_us   |0     | Fail if the p99 latency in us is larger, 0 disables "
+    "it }"
+    "{h        |false | Print help }"
+    ;
+
+
+void fill_sample(const uint64_t i, fdcl::Frame &frame, std::vector<int> &ids,
+    std::vector<cv::Vec3d> &rvecs, std::vector<cv::Vec3d> &tvecs) {
+
+    frame.id = i;
+    frame.capture_ns = fdcl::monotonic_ns();
+    frame.position_ms = static_cast<double>(i);
+    frame.image.setTo(cv::Scalar::all(static_cast<double>(i % 251)));
+
+    const int n_poses = static_cast<int>(i % 4) + 1;
+    ids.resize(n_poses);
+    rvecs.resize(n_poses);
+    tvecs.resize(n_poses);
+    for (int j = 0; j < n_poses; j++) {
+        ids[j] = j;
+        rvecs[j] = cv::Vec3d(static_cast<double>(i), j, 0.5);
+        tvecs[j] = cv::Vec3d(j, static_cast<double>(i), -0.5);
+    }
+}
+
+
+bool check_sample(const uint64_t i, const fdcl::ShmSample &sample,
+    const cv::Mat &frame, const cv::Size &size) {
+
+    if (sample.frame_id != i || sample.position_ms != static_cast<double>(i) ||
+        sample.poses.size() != i % 4 + 1) {
+        std::cerr << "Sample " << i << " does not match, got frame "
+            << sample.frame_id << " with " << sample.poses.size()
+            << " poses\n";
+        return false;
+    }
+
+    for (size_t j = 0; j < sample.poses.size(); j++) {
+        const fdcl::PoseRecord &pose = sample.poses[j];
+        if (pose.id != static_cast<int>(j) || pose.rvec[0] != i ||
+            pose.tvec[1] != i || pose.confidence >= 0) {
+            std::cerr << "Pose " << j << " of sample " << i
+                << " does not match\n";
+            return false;
+        }
+    }
+
+    const double value = static_cast<double>(i % 251);
+    double min_value, max_value;
+    cv::minMaxLoc(frame.reshape(1), &min_value, &max_value);
+    if (frame.size() != size || min_value != value || max_value != value) {
+        std::cerr << "Frame of sample " << i << " does not match\n";
+        return false;
+    }
+
+    return true;
+}
+}
+
+
+int main(int argc, char **argv) {
+    cv::CommandLineParser parser(argc, argv, keys);
+    parser.about(about);
+    if (parser.get<bool>("h")) {
+        parser.printMessage();
+        return 0;
+    }
+
+    const int n_samples = parser.get<int>("n");
+    const int n_slots = parser.get<int>("s");
+    const cv::Size size(parser.get<int>("c"), parser.get<int>("r"));
+    const double max_us = parser.get<double>("max_us");
+    if (!parser.check()) {
+        parser.printErrors();
+        return 1;
+    }
+
+    const std::string name = "/fdcl_shm_check_" + std::to_string(getpid());
+    const size_t frame_bytes = size.area() * CV_ELEM_SIZE(CV_8UC3);
+
+    // Slot counts out of range must be rejected, not wrapped around.
+    fdcl::ShmWriter writer;
+    if (writer.create(name, 0, frame_bytes) ||
+        writer.create(name, -1, frame_bytes) ||
+        writer.create(name, fdcl::shm_max_slots + 1, frame_bytes)) {
+        std::cerr << "Invalid slot counts were accepted\n";
+        return 1;
+    }
+
+    if (!writer.create(name, n_slots, frame_bytes)) {
+        return 1;
+    }
+
+    fdcl::ShmReader reader;
+    if (!reader.attach(name)) {
+        std::cerr << "Failed to attach to " << name << "\n";
+        return 1;
+    }
+
+    // The writer publishes from its own thread, one sample at a time, once
+    // the previous one was read, so each latency is a cross thread hand off.
+    std::atomic<uint64_t> acked(0);
+    std::atomic<bool> failed(false);
+    std::thread writer_thread([&]() {
+        fdcl::Frame frame;
+        std::vector<int> ids;
+        std::vector<cv::Vec3d> rvecs, tvecs;
+
+        for (uint64_t i = 1; i <= static_cast<uint64_t>(n_samples); i++) {
+            while (acked.load(std::memory_order_acquire) != i - 1) {
+                if (failed.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+
+            // Written straight into the slot, like pose_estimation does.
+            frame.image = writer.acquire(size, CV_8UC3);
+            fill_sample(i, frame, ids, rvecs, tvecs);
+            writer.publish(frame, ids, rvecs, tvecs);
+        }
+    });
+
+    fdcl::ShmSample sample;
+    cv::Mat frame;
+    std::vector<double> latencies_us;
+    latencies_us.reserve(n_samples);
+
+    const int64_t timeout_ns = 5000000000LL;
+    int64_t last_ns = fdcl::monotonic_ns();
+    for (uint64_t i = 1; i <= static_cast<uint64_t>(n_samples); ) {
+        if (!reader.read_latest(sample, &frame)) {
+            if (fdcl::monotonic_ns() - last_ns > timeout_ns) {
+                std::cerr << "Timed out waiting for sample " << i << "\n";
+                failed = true;
+                break;
+            }
+            continue;
+        }
+
+        const int64_t now_ns = fdcl::monotonic_ns();
+        latencies_us.push_back((now_ns - sample.publish_ns) * 1e-3);
+        last_ns = now_ns;
+
+        if (!check_sample(i, sample, frame, size)) {
+            failed = true;
+            break;
+        }
+
+        acked.store(i, std::memory_order_release);
+        i++;
+    }
+
+    writer_thread.join();
+    reader.detach();
+    writer.close();
+
+    if (failed || latencies_us.empty()) {
+        return 1;
+    }
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    const size_t n = latencies_us.size();
+    const double p99 = latencies_us[std::min(n - 1, n * 99 / 100)];
+    std::printf("%zu samples of %dx%d, %d slots, latency us: min %.1f "
+        "p50 %.1f p99 %.1f max %.1f\n", n, size.width, size.height, n_slots,
+        latencies_us[0], latencies_us[n / 2], p99, latencies_us[n - 1]);
+
+    if (max_us > 0 && p99 > max_us) {
+        std::cerr << "p99 latency is above " << max_us << " us\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2019 Flight Dynamics and Control Lab
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "fdcl_common.hpp"
+#include "fdcl_config.hpp"
+#include "fdcl_shm.hpp"
+
+
+namespace {
+const char* about = "Read the frames and the poses published by "
+    "pose_estimation through shared memory, and measure the latency";
+const char* keys  =
+    "{n        |/fdcl_pose | Shared memory name given to pose_estimation }"
+    "{c        |0     | Number of samples to measure, 0 runs until ESC }"
+    "{f        |false | Copy and show the frames }"
+    "{p        |false | Print the poses }"
+    "{cfg      |      | Pipeline config file, for the shared memory name "
+    "unless -n is given }"
+    "{h        |false | Print help }"
+    ;
+}
+
+
+void print_latency(std::vector<double> &latencies_us, const uint64_t received,
+    const uint64_t skipped) {
+
+    if (latencies_us.empty()) {
+        return;
+    }
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+
+    double sum = 0.0;
+    for (size_t i = 0; i < latencies_us.size(); i++) {
+        sum += latencies_us[i];
+    }
+
+    const size_t n = latencies_us.size();
+    std::printf("latency us: min %.1f mean %.1f p50 %.1f p99 %.1f max %.1f"
+        "  (received %llu, skipped %llu)\n", latencies_us[0], sum / n,
+        latencies_us[n / 2], latencies_us[std::min(n - 1, n * 99 / 100)],
+        latencies_us[n - 1], static_cast<unsigned long long>(received),
+        static_cast<unsigned long long>(skipped));
+
+    latencies_us.clear();
+}
+
+
+int main(int argc, char **argv) {
+    cv::CommandLineParser parser(argc, argv, keys);
+
+    auto success = parse_inputs(parser, about);
+    if (!success) {
+        return 1;
+    }
+
+    fdcl::PipelineConfig config;
+    if (!fdcl::parse_pipeline_config(parser, config)) {
+        return 1;
+    }
+
+    const fdcl::CommandLineArgs args(parser, argc, argv, config);
+    if (!args.read("n", config.shm) && config.shm.empty()) {
+        // The config file has no sinks.shm, fall back to the default name.
+        config.shm = parser.get<std::string>("n");
+    }
+
+    const std::string name = config.shm;
+    if (name.empty()) {
+        std::cerr << "Shared memory name is required\n";
+        return 1;
+    }
+    int n_samples = parser.get<int>("c");
+    bool show_frames = parser.get<bool>("f");
+    bool print_poses = parser.get<bool>("p");
+
+    fdcl::ShmReader reader;
+    fdcl::ShmSample sample;
+    cv::Mat frame;
+
+    std::vector<double> latencies_us;
+    uint64_t received = 0, skipped = 0, last_frame_id = 0;
+    bool waiting = false;
+
+    while (n_samples <= 0 || received < static_cast<uint64_t>(n_samples)) {
+        // Attach, or re-attach if the writer restarted.
+        if (!reader.writer_alive()) {
+            if (!waiting) {
+                std::cout << "Waiting for " << name << "\n";
+                waiting = true;
+            }
+
+            reader.detach();
+            if (!reader.attach(name)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+
+            std::cout << "Attached to " << name << "\n";
+            waiting = false;
+            received = 0;
+        }
+
+        if (!reader.read_latest(sample, show_frames ? &frame : nullptr)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            continue;
+        }
+
+        const int64_t now_ns = fdcl::monotonic_ns();
+        latencies_us.push_back((now_ns - sample.publish_ns) * 1e-3);
+
+        if (received > 0 && sample.frame_id > last_frame_id + 1) {
+            skipped += sample.frame_id - last_frame_id - 1;
+        }
+        last_frame_id = sample.frame_id;
+        received++;
+
+        if (print_poses) {
+            for (size_t i = 0; i < sample.poses.size(); i++) {
+                const fdcl::PoseRecord &pose = sample.poses[i];
+                std::printf("frame %llu time %lld ns id %d conf %.2f "
+                    "t [%.4f %.4f %.4f] r [%.4f %.4f %.4f]\n",
+                    static_cast<unsigned long long>(sample.frame_id),
+                    static_cast<long long>(sample.capture_ns), pose.id,
+                    pose.confidence,
+                    pose.tvec[0], pose.tvec[1], pose.tvec[2],
+                    pose.rvec[0], pose.rvec[1], pose.rvec[2]);
+            }
+        }
+
+        if (latencies_us.size() >= 100) {
+            print_latency(latencies_us, received, skipped);
+        }
+
+        if (show_frames && !frame.empty()) {
+            cv::imshow("Shared memory", frame);
+            char key = (char)cv::waitKey(1);
+            if (key == 27) {
+                break;
+            }
+        }
+    }
+
+    print_latency(latencies_us, received, skipped);
+
+    return 0;
+}